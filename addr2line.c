@@ -26,6 +26,7 @@
  */
 
 #include <sys/param.h>
+#include <sys/ktrace.h>
 #include <sys/queue.h>
 #include <sys/tree.h>
 
@@ -36,7 +37,6 @@
 #include <getopt.h>
 #include <libdwarf.h>
 #include <libelftc.h>
-#include <libgen.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +44,7 @@
 #include <unistd.h>
 
 #include "libelftc.h"
+#include "mdump.h"
 
 struct Func {
 	char *name;
@@ -69,15 +70,14 @@ struct CU {
 	Dwarf_Debug dbg;
 };
 
-void addr2line(const char *, uintptr_t, char **);
-
-static int demangle = 1, func = 1, base, inlines, print_addr, pretty_print = 1;
+static int demangle = 1, func = 1, inlines;
 static char unknown[] = { '?', '?', '\0' };
 static Dwarf_Addr section_base;
 /* Need a new curlopc that stores last lopc value. */
 static Dwarf_Unsigned curlopc;
 static RB_HEAD(cutree, CU) cuhead;
-static FILE *stream;
+
+struct addr2line_stats a2lstats;
 
 static int
 lopccmp(struct CU *e1, struct CU *e2)
@@ -313,11 +313,38 @@ cont_search:
 		dwarf_dealloc(dbg, spec_die, DW_DLA_DIE);
 }
 
-static void
-print_inlines(struct CU *cu, struct Func *f, Dwarf_Unsigned call_file,
-    Dwarf_Unsigned call_line)
+/*
+ * Intern a function name, demangled.  The demangled name is remembered as
+ * an alias, so every name is demangled once.
+ */
+static size_t
+func_intern(const char *name)
 {
 	char demangled[1024];
+	size_t id, alias;
+
+	if (!func || name == NULL)
+		return sym_intern(unknown);
+	id = sym_intern(name);
+	if ((alias = sym_alias(id)) != SYM_NONE)
+		return alias;
+	if (demangle && !elftc_demangle(name, demangled, sizeof(demangled), 0))
+		alias = sym_intern(demangled);
+	else
+		alias = id;
+	sym_setalias(id, alias);
+	return alias;
+}
+
+/*
+ * Intern the frame of the function f was inlined into, at the call site,
+ * and the ones that function was inlined into in turn.
+ */
+static size_t
+inline_frames(struct CU *cu, struct Func *f, Dwarf_Unsigned call_file,
+    Dwarf_Unsigned call_line)
+{
+	struct frame fr;
 	char *file;
 
 	if (call_file > 0 && (Dwarf_Signed) call_file <= cu->nsrcfiles)
@@ -325,29 +352,15 @@ print_inlines(struct CU *cu, struct Func *f, Dwarf_Unsigned call_file,
 	else
 		file = unknown;
 
-	if (pretty_print)
-		fprintf(stream, " (inlined by) ");
-
-	if (func) {
-		if (demangle && !elftc_demangle(f->name, demangled,
-		    sizeof(demangled), 0)) {
-			if (pretty_print)
-				fprintf(stream, "%s at ", demangled);
-			else
-				fprintf(stream, "%s\n", demangled);
-		} else {
-			if (pretty_print)
-				fprintf(stream, "%s at ", f->name);
-			else
-				fprintf(stream, "%s\n", f->name);
-		}
-	}
-	fprintf(stream, "%s:%ju\n", base ? basename(file) : file,
-	    (uintmax_t) call_line);
-
 	if (f->inlined_caller != NULL)
-		print_inlines(cu, f->inlined_caller, f->call_file,
+		fr.caller = inline_frames(cu, f->inlined_caller, f->call_file,
 		    f->call_line);
+	else
+		fr.caller = FRAME_NONE;
+	fr.func = func_intern(f->name);
+	fr.file = sym_intern(file);
+	fr.line = call_line;
+	return frame_intern(&fr);
 }
 
 static struct CU *
@@ -466,8 +479,8 @@ check_range(Dwarf_Debug dbg, Dwarf_Die die, Dwarf_Unsigned addr,
 	}
 }
 
-static void
-translate(Dwarf_Debug dbg, Elf *e, Dwarf_Unsigned addr, char **name)
+static size_t
+translate(Dwarf_Debug dbg, Dwarf_Unsigned addr)
 {
 	Dwarf_Die die, ret_die;
 	Dwarf_Line *lbuf;
@@ -478,10 +491,10 @@ translate(Dwarf_Debug dbg, Elf *e, Dwarf_Unsigned addr, char **name)
 	Dwarf_Addr lineaddr, plineaddr;
 	struct CU *cu;
 	struct Func *f;
+	struct frame fr;
 	const char *funcname;
 	char *file, *file0, *pfile;
-	char demangled[1024];
-	int ec, i, ret;
+	int i, ret;
 
 	addr += section_base;
 	lineno = 0;
@@ -603,48 +616,16 @@ out:
 			funcname = f->name;
 	}
 
-	if (print_addr) {
-		if ((ec = gelf_getclass(e)) == ELFCLASSNONE) {
-			warnx("gelf_getclass failed: %s", elf_errmsg(-1));
-			ec = ELFCLASS64;
-		}
-		if (ec == ELFCLASS32) {
-			if (pretty_print)
-				fprintf(stream, "0x%08jx: ", (uintmax_t) addr);
-			else
-				fprintf(stream, "0x%08jx\n", (uintmax_t) addr);
-		} else {
-			if (pretty_print)
-				fprintf(stream, "0x%016jx: ", (uintmax_t) addr);
-			else
-				fprintf(stream, "0x%016jx\n", (uintmax_t) addr);
-		}
-	}
-
-	if (func) {
-		if (funcname == NULL)
-			funcname = unknown;
-		if (demangle && !elftc_demangle(funcname, demangled,
-		    sizeof(demangled), 0)) {
-			if (pretty_print)
-				fprintf(stream, "%s at ", demangled);
-			else
-				fprintf(stream, "%s\n", demangled);
-		} else {
-			if (pretty_print)
-				fprintf(stream, "%s at ", funcname);
-			else
-				fprintf(stream, "%s\n", funcname);
-		}
-	}
-
-	(void) fprintf(stream, "%s:%ju\n", base ? basename(file) : file,
-	    (uintmax_t) lineno);
-
 	if (ret == DW_DLV_OK && inlines && cu != NULL &&
 	    cu->srcfiles != NULL && f != NULL && f->inlined_caller != NULL)
-		print_inlines(cu, f->inlined_caller, f->call_file,
+		fr.caller = inline_frames(cu, f->inlined_caller, f->call_file,
 		    f->call_line);
+	else
+		fr.caller = FRAME_NONE;
+	fr.func = func_intern(funcname);
+	fr.file = sym_intern(file);
+	fr.line = lineno;
+	return frame_intern(&fr);
 }
 
 static void
@@ -706,28 +687,80 @@ find_section_base(const char *exe, Elf *e, const char *section)
 	errx(EXIT_FAILURE, "%s: cannot find section %s", exe, section);
 }
 
-void
-addr2line(const char *object, uintptr_t addr, char **name)
+/*
+ * libdwarf reads all debug sections of an object when it is opened, so
+ * they all count as touched.
+ */
+static void
+count_debug(Elf *e)
 {
+	Elf_Scn *scn;
+	GElf_Shdr sh;
+	size_t shstrndx;
+	const char *name;
+
+	if (!elf_getshstrndx(e, &shstrndx))
+		return;
+	scn = NULL;
+	while ((scn = elf_nextscn(e, scn)) != NULL) {
+		if (gelf_getshdr(scn, &sh) == NULL ||
+		    (name = elf_strptr(e, shstrndx, sh.sh_name)) == NULL)
+			continue;
+		if (strncmp(name, ".debug_", 7) == 0 ||
+		    strncmp(name, ".zdebug_", 8) == 0)
+			a2lstats.dwarfbytes += sh.sh_size;
+	}
+}
+
+/*
+ * Intern the frames debuginfo_lookup() found, innermost first.
+ */
+static size_t
+loc_frames(const struct dbgloc *locs, size_t n)
+{
+	struct frame fr;
+	size_t caller = FRAME_NONE;
+
+	if (!inlines)
+		n = 1;
+	while (n-- > 0) {
+		fr.func = func_intern(locs[n].func);
+		fr.file = sym_intern(locs[n].file != NULL ? locs[n].file :
+		    unknown);
+		fr.line = locs[n].line;
+		fr.caller = caller;
+		caller = frame_intern(&fr);
+	}
+	return caller;
+}
+
+/*
+ * Symbolize addr in object, and return the id of its frame.  The
+ * decoder in debuginfo.c does most objects; libdwarf the rest.
+ */
+size_t
+addr2line(const char *object, uintptr_t addr)
+{
+	struct dbgloc locs[DBGLOC_MAX];
 	Elf *e;
 	Dwarf_Debug dbg;
 	Dwarf_Error de;
 	const char *section;
 	int fd;
 	struct CU *cu, *cu0;
+	size_t frame, n;
 
-	size_t sz;
-	stream = open_memstream(name, &sz);
-	if (stream == NULL)
-		err(1, NULL);
+	a2lstats.calls++;
+	if (object == NULL)
+		object = "a.out";
+	if ((n = debuginfo_lookup(object, addr, locs, nitems(locs))) != 0)
+		return loc_frames(locs, n);
 
+	a2lstats.fallbacks++;
 	RB_INIT(&cuhead);
 	curlopc = ~0UL;
 	section = NULL;
 
-	if (object == NULL)
-		object = "a.out";
-
 	if ((fd = open(object, O_RDONLY)) < 0)
 		err(EXIT_FAILURE, "%s", object);
 
@@ -738,19 +771,20 @@ addr2line(const char *object, uintptr_t addr, char **name)
 
 	if (dwarf_get_elf(dbg, &e, &de) != DW_DLV_OK)
 		errx(EXIT_FAILURE, "dwarf_get_elf: %s", dwarf_errmsg(de));
+	a2lstats.opened++;
+	count_debug(e);
 
 	if (section)
 		find_section_base(object, e, section);
 	else
 		section_base = 0;
 
-	translate(dbg, e, addr, name);
+	frame = translate(dbg, addr);
 
 	dwarf_finish(dbg, &de);
 
 	elf_end(e);
 
-	fclose(stream);
 	RB_FOREACH_SAFE(cu, cutree, &cuhead, cu0) {
 		struct Func *f, *f0;
 		TAILQ_FOREACH_SAFE(f, &cu->funclist, next, f0) {
@@ -759,4 +793,5 @@ addr2line(const char *object, uintptr_t addr, char **name)
 		}
 		free(cu);
 	}
+	return frame;
 }
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Records that don't match the live set: an allocation of a pointer that
+ * is live already, or a realloc or free of one that isn't.  They are
+ * counted by kind and stack, with the first few pointers as examples,
+ * and reported once at the end (or on the socket of -s), so a trace full
+ * of them costs a tree lookup each instead of a stack trace on stderr.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+RB_HEAD(anomalies, anomaly);
+RB_PROTOTYPE_STATIC(anomalies, anomaly, entry, anomalycmp)
+
+static const char *kindnames[ANOMALY_MAX] = {
+	[ANOMALY_DUPMALLOC] = "mallocs of a live pointer",
+	[ANOMALY_DUPREALLOC] = "reallocs to a live pointer",
+	[ANOMALY_REALLOC] = "reallocs of an unknown pointer",
+	[ANOMALY_FREE] = "frees of an unknown pointer"
+};
+
+static struct anomalies anomalies = RB_INITIALIZER(&anomalies);
+static size_t counts[ANOMALY_MAX];
+static size_t nanomalies;
+
+static int
+anomalycmp(const struct anomaly *a1, const struct anomaly *a2)
+{
+	if (a1->kind != a2->kind)
+		return a1->kind < a2->kind ? -1 : 1;
+	if (a1->stack->id != a2->stack->id)
+		return a1->stack->id < a2->stack->id ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Count an anomaly of kind at p, by the record from st.  For duplicates,
+ * orig is the stack of the allocation already live.
+ */
+void
+anomaly_add(int kind, uintptr_t p, struct stack *st, struct stack *orig)
+{
+	struct anomaly *an, search;
+
+	counts[kind]++;
+	search.kind = kind;
+	search.stack = st;
+	if ((an = RB_FIND(anomalies, &anomalies, &search)) == NULL) {
+		an = xmalloc(sizeof(*an));
+		memset(an, 0, sizeof(*an));
+		an->kind = kind;
+		an->stack = st;
+		an->orig = orig;
+		RB_INSERT(anomalies, &anomalies, an);
+		nanomalies++;
+	}
+	if (an->count < ANOMALY_EXAMPLES)
+		an->examples[an->count] = p;
+	an->count++;
+}
+
+void
+anomaly_reset(void)
+{
+	struct anomaly *an, *next;
+
+	RB_FOREACH_SAFE(an, anomalies, &anomalies, next) {
+		RB_REMOVE(anomalies, &anomalies, an);
+		free(an);
+	}
+	memset(counts, 0, sizeof(counts));
+	nanomalies = 0;
+}
+
+size_t
+anomaly_count(void)
+{
+	return nanomalies;
+}
+
+void
+anomaly_foreach(void (*fn)(const struct anomaly *, void *), void *arg)
+{
+	struct anomaly *an;
+
+	RB_FOREACH(an, anomalies, &anomalies)
+		fn(an, arg);
+}
+
+/* Add an anomaly saved with anomaly_foreach(), e.g. in a checkpoint. */
+void
+anomaly_restore(const struct anomaly *saved)
+{
+	struct anomaly *an;
+
+	an = xmalloc(sizeof(*an));
+	*an = *saved;
+	if (RB_INSERT(anomalies, &anomalies, an) != NULL)
+		errx(1, "duplicate anomaly");
+	counts[an->kind] += an->count;
+	nanomalies++;
+}
+
+static int
+countcmp(const void *a, const void *b)
+{
+	const struct anomaly *a1 = *(struct anomaly *const *)a;
+	const struct anomaly *a2 = *(struct anomaly *const *)b;
+
+	return a1->count < a2->count ? 1 : a1->count > a2->count ? -1 : 0;
+}
+
+/*
+ * Print the totals, then the ntop most frequent anomalies by stack, or
+ * all of them with ntop 0.  Returns the number of stacks.
+ */
+size_t
+anomaly_report(FILE *fp, size_t ntop)
+{
+	struct anomaly *an, **top;
+	size_t n = 0, i, j;
+	int k;
+
+	if (nanomalies == 0)
+		return 0;
+	fprintf(fp, "Records not matching the live set:\n");
+	for (k = 0; k < ANOMALY_MAX; k++)
+		if (counts[k] != 0)
+			fprintf(fp, "%10zu %s\n", counts[k], kindnames[k]);
+
+	top = xmalloc(nanomalies * sizeof(*top));
+	RB_FOREACH(an, anomalies, &anomalies)
+		top[n++] = an;
+	qsort(top, n, sizeof(*top), countcmp);
+	for (i = 0; i < n && (ntop == 0 || i < ntop); i++) {
+		an = top[i];
+		fprintf(fp, "%zu %s, e.g.", an->count, kindnames[an->kind]);
+		for (j = 0; j < an->count && j < ANOMALY_EXAMPLES; j++)
+			fprintf(fp, " %p", (void *)an->examples[j]);
+		if (an->stack->nobj == 0)
+			fputc('\n', fp);
+		else {
+			fprintf(fp, ", from:\n");
+			stack_print(fp, an->stack);
+		}
+		if (an->orig != NULL) {
+			fprintf(fp, "the first one was live, allocated from:\n");
+			stack_print(fp, an->orig);
+		}
+	}
+	if (i < n)
+		fprintf(fp, "and %zu more stacks\n", n - i);
+	free(top);
+	return n;
+}
+
+RB_GENERATE_STATIC(anomalies, anomaly, entry, anomalycmp)
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Time addr2line() on addresses sampled from the functions of ELF objects
+ * built with debug information.  The first pass over an object is the
+ * cold one, the ones after it are warm; for every pass the latency
+ * percentiles per address, the debug information read and the number of
+ * times the object was opened are shown.
+ *
+ *	a2lbench [-n addrs] [-r rounds] [-x seed] object ...
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdump.h"
+
+struct func {
+	uintptr_t lo;
+	size_t size;
+};
+
+static uint64_t rnd = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+xrandom(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+	return rnd;
+}
+
+/*
+ * Pick n addresses inside the functions of the symbol table of file.
+ */
+static void
+sample(const char *file, uintptr_t *addrs, size_t n)
+{
+	struct func *funcs = NULL;
+	size_t nfuncs = 0, i, j, cnt;
+	Elf_Scn *scn = NULL;
+	Elf_Data *data;
+	GElf_Shdr sh;
+	GElf_Sym sym;
+	Elf *e;
+	int fd, type;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		err(1, "%s", file);
+	if ((e = elf_begin(fd, ELF_C_READ, NULL)) == NULL)
+		errx(1, "%s: %s", file, elf_errmsg(-1));
+	/* The full symbol table, or the dynamic one of a stripped file. */
+	for (type = SHT_SYMTAB; nfuncs == 0 && type != 0;
+	    type = type == SHT_SYMTAB ? SHT_DYNSYM : 0) {
+		scn = NULL;
+		while ((scn = elf_nextscn(e, scn)) != NULL) {
+			if (gelf_getshdr(scn, &sh) == NULL ||
+			    sh.sh_type != (unsigned)type || sh.sh_entsize == 0 ||
+			    (data = elf_getdata(scn, NULL)) == NULL)
+				continue;
+			cnt = sh.sh_size / sh.sh_entsize;
+			if ((funcs = reallocarray(funcs, nfuncs + cnt,
+			    sizeof(*funcs))) == NULL)
+				err(1, NULL);
+			for (j = 0; j < cnt; j++) {
+				if (gelf_getsym(data, j, &sym) == NULL ||
+				    GELF_ST_TYPE(sym.st_info) != STT_FUNC ||
+				    sym.st_shndx == SHN_UNDEF ||
+				    sym.st_size == 0)
+					continue;
+				funcs[nfuncs].lo = sym.st_value;
+				funcs[nfuncs].size = sym.st_size;
+				nfuncs++;
+			}
+		}
+	}
+	elf_end(e);
+	close(fd);
+	if (nfuncs == 0)
+		errx(1, "%s: no functions", file);
+
+	for (i = 0; i < n; i++) {
+		j = xrandom() % nfuncs;
+		addrs[i] = funcs[j].lo + xrandom() % funcs[j].size;
+	}
+	free(funcs);
+}
+
+/* symbol.c needs it; mdump.c has the real one. */
+void *
+xmalloc(size_t sz)
+{
+	void *p = malloc(sz);
+
+	if (p == NULL)
+		err(1, NULL);
+	return p;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+dblcmp(const void *a, const void *b)
+{
+	double d1 = *(const double *)a, d2 = *(const double *)b;
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+static void
+pass(const char *file, const char *name, const uintptr_t *addrs, size_t n,
+    double *lat)
+{
+	struct addr2line_stats before = a2lstats;
+	double t;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		t = now();
+		addr2line(file, addrs[i]);
+		lat[i] = (now() - t) * 1e6;
+	}
+
+	qsort(lat, n, sizeof(*lat), dblcmp);
+	printf("%-24s %-4s %6zu addrs  p50 %9.1fus  p90 %9.1fus  "
+	    "p99 %9.1fus  max %9.1fus  %10.1f KB/addr  %zu opens\n",
+	    file, name, n, lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100],
+	    lat[n - 1],
+	    (double)(a2lstats.dwarfbytes - before.dwarfbytes) / n / 1024,
+	    a2lstats.opened - before.opened);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: a2lbench [-n addrs] [-r rounds] [-x seed] "
+	    "object ...\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *errstr;
+	size_t naddrs = 1000, rounds = 2, r;
+	uintptr_t *addrs;
+	double *lat;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "n:r:x:")) != -1)
+		switch (ch) {
+		case 'n':
+			naddrs = strtonum(optarg, 1, 10000000, &errstr);
+			if (errstr != NULL)
+				errx(1, "-n %s: %s", optarg, errstr);
+			break;
+		case 'r':
+			rounds = strtonum(optarg, 0, 1000, &errstr);
+			if (errstr != NULL)
+				errx(1, "-r %s: %s", optarg, errstr);
+			break;
+		case 'x':
+			rnd = strtonum(optarg, 1, LLONG_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "-x %s: %s", optarg, errstr);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		errx(1, "elf_version: %s", elf_errmsg(-1));
+	if ((addrs = calloc(naddrs, sizeof(*addrs))) == NULL ||
+	    (lat = calloc(naddrs, sizeof(*lat))) == NULL)
+		err(1, NULL);
+
+	for (i = 0; i < argc; i++) {
+		sample(argv[i], addrs, naddrs);
+		pass(argv[i], "cold", addrs, naddrs, lat);
+		for (r = 0; r < rounds; r++)
+			pass(argv[i], "warm", addrs, naddrs, lat);
+	}
+	return 0;
+}
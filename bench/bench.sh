@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Replay synthetic traces with mdump and report throughput and peak RSS:
+#
+#	parse	allocations freed right away, so reading and decoding the
+#		records is most of the work
+#	replay	a big live set with random churn and reallocs
+#	spill	the same, with the live set bounded by -b
+#	symbol	many distinct frames in a real object with debug
+#		information, so symbolization dominates
+#
+# Usage: bench.sh [-n events] [-k] [mdump]
+# -k keeps the generated traces in the working directory.
+
+set -e
+
+events=1000000
+keep=0
+while getopts kn: ch; do
+	case $ch in
+	k)	keep=1 ;;
+	n)	events=$OPTARG ;;
+	*)	echo "usage: bench.sh [-n events] [-k] [mdump]" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+mdump=${1:-mdump}
+dir=$(dirname "$0")
+
+# Symbolize mdump itself, if it has debug information.
+elf=$(command -v "$mdump" || true)
+
+tmp=$(mktemp -d)
+[ $keep -eq 1 ] || trap 'rm -rf "$tmp"' EXIT
+
+run() {
+	name=$1
+	n=$2
+	shift 2
+	"$dir/gentrace" -f "$tmp/$name.out" -n "$n" "$@"
+	"$dir/benchrun" "$name" "$n" "$mdump" -f "$tmp/$name.out"
+	[ $keep -eq 0 ] || cp "$tmp/$name.out" .
+}
+
+run parse "$events" -l 1 -s 100
+run replay "$events" -l $((events / 4)) -r 20
+
+"$dir/gentrace" -f "$tmp/spill.out" -n "$events" -l $((events / 4)) -r 20
+"$dir/benchrun" spill "$events" "$mdump" -b 1m -f "$tmp/spill.out"
+
+if [ -n "$elf" ]; then
+	run symbol $((events / 10)) -e "$elf" -s 20000 -d 32 -l 1000
+fi
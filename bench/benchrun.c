@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run a command, with its output thrown away, and print one line: the
+ * name of the benchmark, wall and CPU seconds, events per second and the
+ * peak resident set size.
+ *
+ *	benchrun name events command [arg ...]
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double
+tv2d(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec t0, t1;
+	struct rusage ru;
+	double wall, cpu, events;
+	long maxrss;
+	pid_t pid;
+	int status, fd;
+
+	if (argc < 4) {
+		fprintf(stderr, "usage: benchrun name events command "
+		    "[arg ...]\n");
+		return 1;
+	}
+	events = strtod(argv[2], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		if ((fd = open("/dev/null", O_WRONLY)) == -1)
+			err(1, "/dev/null");
+		dup2(fd, STDOUT_FILENO);
+		execvp(argv[3], &argv[3]);
+		err(1, "%s", argv[3]);
+	}
+	if (wait4(pid, &status, 0, &ru) == -1)
+		err(1, "wait4");
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s: %s failed", argv[1], argv[3]);
+
+	wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	cpu = tv2d(&ru.ru_utime) + tv2d(&ru.ru_stime);
+	/* Kilobytes on both OpenBSD and Linux. */
+	maxrss = ru.ru_maxrss;
+	printf("%-12s %10.0f events %8.3fs wall %8.3fs cpu %12.0f events/s "
+	    "%8ld KB rss\n", argv[1], events, wall, cpu,
+	    wall > 0 ? events / wall : 0, maxrss);
+	return 0;
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Write a large C++ source file with deep inlining: every module has a
+# recursive template that is inlined 12 levels deep, instantiated for
+# several types, and run over standard containers.  Compiled with -O2 -g
+# it gives the symbolizer long inline chains and many ranges to search.
+#
+# Usage: gencxx.sh [modules] > heavy.cc
+
+n=${1:-200}
+
+cat <<EOF
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <vector>
+
+template <typename T, int N> struct Chain {
+	static inline __attribute__((always_inline)) T
+	step(T x, T k)
+	{
+		return Chain<T, N - 1>::step(x ^ (x >> 3), k) + (T)N * k;
+	}
+};
+
+template <typename T> struct Chain<T, 0> {
+	static inline T step(T x, T) { return x; }
+};
+EOF
+
+i=0
+while [ $i -lt "$n" ]; do
+	cat <<EOF
+
+namespace m$i {
+template <typename T> static inline T
+run(const std::vector<T> &v)
+{
+	T s = 0;
+	for (auto x : v)
+		s += Chain<T, 12>::step(x, (T)$i);
+	return s;
+}
+
+template <typename T> static inline T
+sorted(std::vector<T> v)
+{
+	std::sort(v.begin(), v.end());
+	return std::accumulate(v.begin(), v.end(), (T)$i);
+}
+}
+
+extern "C" long
+heavy$i(long x)
+{
+	std::vector<long> vl(x % 64, x);
+	std::vector<int> vi(x % 32, (int)x);
+	std::vector<unsigned> vu(x % 16, (unsigned)x);
+	std::map<long, long> m;
+
+	for (long j = 0; j < x % 8; j++)
+		m[j * $i] = m$i::run(vl);
+	return m$i::run(vl) + m$i::run(vi) + m$i::run(vu) +
+	    m$i::sorted(vl) + (long)m.size();
+}
+EOF
+	i=$((i + 1))
+done
@@ -0,0 +1,615 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Write a synthetic ktrace.out, as malloc.diff would have produced it,
+ * for benchmarking mdump.  Every process announces its load map and then
+ * sends "mallocbatch" records per pool: stacks are announced once per
+ * pool, allocations keep to their pool and addresses are only reused
+ * within it, so the trace replays without warnings.  Runs on any system,
+ * no OpenBSD kernel needed.
+ */
+
+#include <sys/types.h>
+
+#include <endian.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __OpenBSD__
+#include <sys/ktrace.h>
+#else
+/* Same layout as in OpenBSD's <sys/ktrace.h>. */
+#define KTR_START		0x4b545200
+#define KTR_USER		7
+#define KTR_USER_MAXIDLEN	20
+#define KTR_USER_MAXLEN		2048
+
+struct ktr_header {
+	unsigned int ktr_type;
+	pid_t ktr_pid;
+	pid_t ktr_tid;
+	struct timespec ktr_time;
+	char ktr_comm[24 + 1];
+	size_t ktr_len;
+};
+#endif
+
+/* Same layout as in mdump.h. */
+#define MALLOC_TRACE_MALLOC	1
+#define MALLOC_TRACE_REALLOC	2
+#define MALLOC_TRACE_FREE	3
+#define MALLOC_TRACE_STACK	4
+
+struct malloc_batchent {
+	uint16_t type;
+	uint16_t len;
+};
+
+struct malloc_trace {
+	uintptr_t p;
+	size_t sz;
+	size_t stack;
+};
+
+struct realloc_trace {
+	uintptr_t p;
+	uintptr_t origp;
+	size_t sz;
+	size_t stack;
+};
+
+struct free_trace {
+	uintptr_t p;
+	size_t stack;
+};
+
+struct malloc_tracetime {
+	uint64_t time;
+	uint32_t tid;
+	uint32_t pad;
+};
+
+struct malloc_clock {
+	uint64_t freq;
+	uint64_t time;
+	int64_t sec;
+	int64_t nsec;
+};
+
+struct malloc_mapobj {
+	uintptr_t base;
+	uint16_t nsegs;
+	uint16_t idlen;
+	uint16_t namelen;
+};
+
+struct malloc_mapseg {
+	uintptr_t lo;
+	uintptr_t hi;
+};
+
+#define NPOOLS		8	/* like malloc's default mutexes */
+#define OBJSIZE		(1024 * 1024)	/* text of a made up object */
+#define PIDBASE		10000
+
+enum churn { CHURN_RANDOM, CHURN_FIFO, CHURN_LIFO };
+
+struct live {
+	uintptr_t p;
+	size_t size;
+	int pool;
+};
+
+struct pool {
+	uint8_t buf[KTR_USER_MAXLEN];
+	size_t len;
+	pid_t tid;		/* of the thread that last used it */
+	size_t *ids;		/* trace id per stack, or -1 */
+	uintptr_t *freed;	/* addresses to hand out again */
+	size_t nfreed;
+	size_t freedsize;
+	uintptr_t next;
+};
+
+struct proc {
+	pid_t pid;
+	struct pool pools[NPOOLS];
+	struct live *live;
+	size_t nlive;
+	size_t first;		/* oldest, for CHURN_FIFO */
+	size_t nextid;
+};
+
+static FILE *out;
+static const char *outfile = "ktrace.out";
+static size_t nevents = 1000000, nprocs = 1, nthreads = 4, depth = 16;
+static size_t nstacks = 1000, nobjects = 8, livemax = 10000;
+static unsigned int reallocpct = 10;
+static enum churn churn = CHURN_RANDOM;
+static int timed;
+static const char *elffile;
+static uintptr_t *frames;	/* of every stack, depth each */
+static size_t nframes;
+static uintptr_t textlo, texthi, textbase;	/* of elffile */
+static uint64_t rnd = 0x9e3779b97f4a7c15ULL;
+static uint64_t now;		/* fake clock, ns */
+static struct timespec start;
+
+static uint64_t
+xrandom(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+	return rnd;
+}
+
+static void *
+xcalloc(size_t n, size_t size)
+{
+	void *p;
+
+	if ((p = calloc(n, size)) == NULL)
+		err(1, NULL);
+	return p;
+}
+
+static void
+record(pid_t pid, pid_t tid, const char *id, const void *buf, size_t len)
+{
+	struct ktr_header hdr;
+	char ident[KTR_USER_MAXIDLEN];
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ktr_type = KTR_USER;
+	hdr.ktr_pid = pid;
+	hdr.ktr_tid = tid;
+	hdr.ktr_time.tv_sec = start.tv_sec + now / 1000000000;
+	hdr.ktr_time.tv_nsec = now % 1000000000;
+	memcpy(hdr.ktr_comm, "gentrace", sizeof("gentrace"));
+	hdr.ktr_len = sizeof(ident) + len;
+	memset(ident, 0, sizeof(ident));
+	memcpy(ident, id, strnlen(id, sizeof(ident)));
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(ident, sizeof(ident), 1, out) != 1 ||
+	    (len != 0 && fwrite(buf, len, 1, out) != 1))
+		err(1, "%s", outfile);
+}
+
+/*
+ * The text segment of elffile, so its debug information is used for the
+ * frames.  Only 64 bit little endian ELF is understood.
+ */
+static void
+readelf(const char *file)
+{
+	struct {
+		uint8_t ident[16];
+		uint16_t type, machine;
+		uint32_t version;
+		uint64_t entry, phoff, shoff;
+		uint32_t flags;
+		uint16_t ehsize, phentsize, phnum;
+	} eh;
+	struct {
+		uint32_t type, flags;
+		uint64_t offset, vaddr, paddr, filesz, memsz, align;
+	} ph;
+	size_t i;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
+		err(1, "%s", file);
+	if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) ||
+	    memcmp(eh.ident, "\177ELF\2\1", 6) != 0)
+		errx(1, "%s: not a 64 bit little endian ELF file", file);
+	for (i = 0; i < eh.phnum; i++) {
+		if (pread(fd, &ph, sizeof(ph), eh.phoff + i * eh.phentsize) !=
+		    sizeof(ph))
+			errx(1, "%s: truncated", file);
+		/* PT_LOAD, PF_X */
+		if (ph.type == 1 && (ph.flags & 1) && ph.memsz != 0) {
+			textlo = ph.vaddr;
+			texthi = ph.vaddr + ph.memsz;
+			break;
+		}
+	}
+	close(fd);
+	if (textlo == texthi)
+		errx(1, "%s: no text segment", file);
+	/* Executables are linked at their address, PIE and libraries not. */
+	if (eh.type != 2) {
+		textbase = 0x10000000;
+		textlo += textbase;
+		texthi += textbase;
+	}
+}
+
+static uintptr_t
+objbase(size_t obj)
+{
+	if (elffile != NULL)
+		return textbase;
+	return 0x200000000 + obj * 2 * OBJSIZE;
+}
+
+static void
+loadmap(pid_t pid)
+{
+	uint8_t buf[KTR_USER_MAXLEN];
+	struct malloc_mapobj obj;
+	struct malloc_mapseg seg;
+	char name[PATH_MAX];
+	size_t i;
+
+	for (i = 0; i < (elffile != NULL ? 1 : nobjects); i++) {
+		if (elffile != NULL) {
+			seg.lo = textlo;
+			seg.hi = texthi;
+			snprintf(name, sizeof(name), "%s", elffile);
+		} else {
+			seg.lo = objbase(i);
+			seg.hi = seg.lo + OBJSIZE;
+			snprintf(name, sizeof(name), "/nonexistent/lib%zu.so",
+			    i);
+		}
+		memset(&obj, 0, sizeof(obj));
+		obj.base = objbase(i);
+		obj.nsegs = 1;
+		obj.namelen = strlen(name);
+		memcpy(buf, &obj, sizeof(obj));
+		memcpy(buf + sizeof(obj), &seg, sizeof(seg));
+		memcpy(buf + sizeof(obj) + sizeof(seg), name, obj.namelen);
+		record(pid, pid, "malloctrmap", buf,
+		    sizeof(obj) + sizeof(seg) + obj.namelen);
+	}
+}
+
+/*
+ * The stacks share their outer frames, like real ones do: frame j of a
+ * stack is one of j + 1 functions times the number of stacks / depth.
+ */
+static void
+makestacks(void)
+{
+	size_t i, j, nfunc;
+	uintptr_t lo, hi;
+
+	nframes = nstacks * depth;
+	frames = xcalloc(nframes, sizeof(*frames));
+	for (i = 0; i < nstacks; i++) {
+		for (j = 0; j < depth; j++) {
+			nfunc = 1 + (nstacks * (depth - j)) / depth;
+			if (elffile != NULL) {
+				lo = textlo;
+				hi = texthi;
+			} else {
+				lo = objbase(xrandom() % nobjects);
+				hi = lo + OBJSIZE;
+			}
+			frames[i * depth + j] = lo +
+			    (xrandom() % nfunc * 4099) % (hi - lo);
+		}
+	}
+}
+
+static void
+flush(struct proc *pr, struct pool *pl)
+{
+	if (pl->len == 0)
+		return;
+	record(pr->pid, pl->tid, "mallocbatch", pl->buf, pl->len);
+	pl->len = 0;
+}
+
+static void
+batch(struct proc *pr, struct pool *pl, int type, const void *rec,
+    size_t len, pid_t tid)
+{
+	struct malloc_batchent ent;
+	struct malloc_tracetime tt;
+	size_t ttlen = 0;
+
+	if (timed && type != MALLOC_TRACE_STACK) {
+		tt.time = now;
+		tt.tid = tid;
+		tt.pad = 0;
+		ttlen = sizeof(tt);
+	}
+	if (pl->len + sizeof(ent) + len + ttlen > sizeof(pl->buf))
+		flush(pr, pl);
+	ent.type = type;
+	ent.len = len + ttlen;
+	memcpy(pl->buf + pl->len, &ent, sizeof(ent));
+	memcpy(pl->buf + pl->len + sizeof(ent), rec, len);
+	memcpy(pl->buf + pl->len + sizeof(ent) + len, &tt, ttlen);
+	pl->len += sizeof(ent) + len + ttlen;
+	pl->tid = tid;
+}
+
+static size_t
+stackid(struct proc *pr, struct pool *pl, size_t st, pid_t tid)
+{
+	uint8_t buf[sizeof(size_t) + KTR_USER_MAXLEN];
+	size_t id;
+
+	if (pl->ids[st] != (size_t)-1)
+		return pl->ids[st];
+	id = pl->ids[st] = pr->nextid++;
+	memcpy(buf, &id, sizeof(id));
+	memcpy(buf + sizeof(id), &frames[st * depth],
+	    depth * sizeof(*frames));
+	batch(pr, pl, MALLOC_TRACE_STACK, buf,
+	    sizeof(id) + depth * sizeof(*frames), tid);
+	return id;
+}
+
+/* Mostly small sizes, some big ones. */
+static size_t
+randsize(void)
+{
+	return (size_t)1 << (3 + xrandom() % 13) | (xrandom() & 7) << 2;
+}
+
+static uintptr_t
+poolalloc(struct pool *pl, size_t size)
+{
+	uintptr_t p;
+
+	if (pl->nfreed != 0 && xrandom() % 4 != 0)
+		return pl->freed[--pl->nfreed];
+	p = pl->next;
+	pl->next += (size + 15) & ~(size_t)15;
+	return p;
+}
+
+static void
+poolfree(struct pool *pl, uintptr_t p)
+{
+	if (pl->nfreed == pl->freedsize) {
+		pl->freedsize = pl->freedsize == 0 ? 1024 : pl->freedsize * 2;
+		if ((pl->freed = reallocarray(pl->freed, pl->freedsize,
+		    sizeof(*pl->freed))) == NULL)
+			err(1, NULL);
+	}
+	pl->freed[pl->nfreed++] = p;
+}
+
+/* Pick the allocation to free, by the churn pattern. */
+static size_t
+victim(struct proc *pr)
+{
+	switch (churn) {
+	case CHURN_FIFO:
+		return pr->first;
+	case CHURN_LIFO:
+		return pr->nlive - 1;
+	default:
+		return xrandom() % pr->nlive;
+	}
+}
+
+static void
+unlive(struct proc *pr, size_t i)
+{
+	if (churn == CHURN_FIFO) {
+		/* A ring: the slot is reused by the next allocation. */
+		pr->first = (pr->first + 1) % livemax;
+		pr->nlive--;
+		return;
+	}
+	pr->live[i] = pr->live[--pr->nlive];
+}
+
+static void
+addlive(struct proc *pr, struct live *l)
+{
+	if (churn == CHURN_FIFO)
+		pr->live[(pr->first + pr->nlive) % livemax] = *l;
+	else
+		pr->live[pr->nlive] = *l;
+	pr->nlive++;
+}
+
+static void
+event(struct proc *pr, pid_t tid)
+{
+	struct malloc_trace mt;
+	struct realloc_trace rt;
+	struct free_trace ft;
+	struct pool *pl;
+	struct live l, *old;
+	size_t st = xrandom() % nstacks, i;
+
+	/* Allocate until the live set is full, then keep it about so. */
+	if (pr->nlive != 0 && (pr->nlive >= livemax || xrandom() % 2 == 0)) {
+		i = victim(pr);
+		old = &pr->live[i];
+		pl = &pr->pools[old->pool];
+		if (xrandom() % 100 < reallocpct) {
+			rt.origp = old->p;
+			rt.sz = randsize();
+			rt.p = poolalloc(pl, rt.sz);
+			rt.stack = stackid(pr, pl, st, tid);
+			batch(pr, pl, MALLOC_TRACE_REALLOC, &rt, sizeof(rt), tid);
+			poolfree(pl, old->p);
+			old->p = rt.p;
+			old->size = rt.sz;
+			return;
+		}
+		ft.p = old->p;
+		ft.stack = stackid(pr, pl, st, tid);
+		batch(pr, pl, MALLOC_TRACE_FREE, &ft, sizeof(ft), tid);
+		poolfree(pl, old->p);
+		unlive(pr, i);
+		return;
+	}
+
+	l.pool = tid % NPOOLS;
+	pl = &pr->pools[l.pool];
+	l.size = randsize();
+	l.p = poolalloc(pl, l.size);
+	mt.p = l.p;
+	mt.sz = l.size;
+	mt.stack = stackid(pr, pl, st, tid);
+	batch(pr, pl, MALLOC_TRACE_MALLOC, &mt, sizeof(mt), tid);
+	addlive(pr, &l);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: gentrace [-K] [-c random | fifo | lifo] "
+	    "[-d depth] [-e elffile]\n"
+	    "\t[-f file] [-l live] [-n events] [-o objects] [-p procs] "
+	    "[-r realloc%%]\n"
+	    "\t[-s stacks] [-t threads] [-x seed]\n");
+	exit(1);
+}
+
+static size_t
+number(const char *s, size_t min, size_t max)
+{
+	unsigned long long n;
+	char *end;
+
+	n = strtoull(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < min || n > max)
+		errx(1, "%s: invalid number", s);
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ktr_header hdr;
+	struct malloc_clock clk;
+	struct proc *procs, *pr;
+	size_t i, j, k;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:d:e:f:Kl:n:o:p:r:s:t:x:")) != -1)
+		switch (ch) {
+		case 'c':
+			if (strcmp(optarg, "random") == 0)
+				churn = CHURN_RANDOM;
+			else if (strcmp(optarg, "fifo") == 0)
+				churn = CHURN_FIFO;
+			else if (strcmp(optarg, "lifo") == 0)
+				churn = CHURN_LIFO;
+			else
+				usage();
+			break;
+		case 'd':
+			depth = number(optarg, 1, 64);
+			break;
+		case 'e':
+			elffile = optarg;
+			break;
+		case 'f':
+			outfile = optarg;
+			break;
+		case 'K':
+			timed = 1;
+			break;
+		case 'l':
+			livemax = number(optarg, 1, SIZE_MAX / 64);
+			break;
+		case 'n':
+			nevents = number(optarg, 0, LLONG_MAX);
+			break;
+		case 'o':
+			nobjects = number(optarg, 1, 1024);
+			break;
+		case 'p':
+			nprocs = number(optarg, 1, 1024);
+			break;
+		case 'r':
+			reallocpct = number(optarg, 0, 100);
+			break;
+		case 's':
+			nstacks = number(optarg, 1, 1 << 24);
+			break;
+		case 't':
+			nthreads = number(optarg, 1, 1 << 16);
+			break;
+		case 'x':
+			rnd = number(optarg, 1, LLONG_MAX);
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind)
+		usage();
+
+	if (elffile != NULL)
+		readelf(elffile);
+	makestacks();
+	if ((out = fopen(outfile, "w")) == NULL)
+		err(1, "%s", outfile);
+	clock_gettime(CLOCK_REALTIME, &start);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ktr_type = htobe32(KTR_START);
+	hdr.ktr_pid = PIDBASE;
+	hdr.ktr_time = start;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		err(1, "%s", outfile);
+
+	procs = xcalloc(nprocs, sizeof(*procs));
+	for (i = 0; i < nprocs; i++) {
+		pr = &procs[i];
+		pr->pid = PIDBASE + i;
+		pr->live = xcalloc(livemax, sizeof(*pr->live));
+		for (j = 0; j < NPOOLS; j++) {
+			pr->pools[j].ids = xcalloc(nstacks, sizeof(size_t));
+			for (k = 0; k < nstacks; k++)
+				pr->pools[j].ids[k] = (size_t)-1;
+			pr->pools[j].next = 0x100000000000 +
+			    (uintptr_t)j * 0x10000000000;
+		}
+		loadmap(pr->pid);
+		if (timed) {
+			clk.freq = 1000000000;
+			clk.time = 0;
+			clk.sec = start.tv_sec;
+			clk.nsec = start.tv_nsec;
+			record(pr->pid, pr->pid, "mallocclock", &clk,
+			    sizeof(clk));
+		}
+	}
+
+	for (i = 0; i < nevents; i++) {
+		now += 1 + xrandom() % 1000;
+		pr = &procs[xrandom() % nprocs];
+		event(pr, pr->pid + 100000 + xrandom() % nthreads);
+	}
+	for (i = 0; i < nprocs; i++)
+		for (j = 0; j < NPOOLS; j++)
+			flush(&procs[i], &procs[i].pools[j]);
+
+	if (fclose(out) == EOF)
+		err(1, "%s", outfile);
+	return 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Save and restore the replay state, so a long trace doesn't have to be
+ * replayed from the start again.  The checkpoint is a native endian
+ * dump, only meant to be read back by the same mdump binary:
+ *
+ *	header (struct ckpt_header)
+ *	strings, in order of id: length, string
+ *	frames, in order of id: function, file, line, caller
+ *	objects: f, path length, path, frame
+ *	load map: lo, hi, base, build-id length, build-id, path length, path
+ *	stacks, in order of id: number of frames, counters, growth fit,
+ *	    frames (as f)
+ *	stack ids announced in the trace: our stack id, or SIZE_MAX
+ *	anomalies: kind, stack id, stack id of the original or SIZE_MAX,
+ *	    count, examples
+ *	threads of -s: tid, allocations, frees, bytes allocated, freed
+ *	live allocations: p, size, stack id
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+#define CKPT_MAGIC	"MDUMPCK8"
+
+struct ckpt_header {
+	char magic[8];
+	struct ktr_header start;	/* identifies the trace */
+	off_t offset;			/* of the next record to replay */
+	pid_t pid;
+	size_t mcur;
+	size_t mmax;
+	size_t samplerate;
+	struct malloc_clock clock;
+	uint64_t now;
+	uint64_t growthevents;
+	size_t growthwindows;
+	uint64_t peaktime;
+	size_t pagespeak;
+	size_t pagespeakbytes;
+	size_t nsyms;
+	size_t nframes;
+	size_t nobjects;
+	size_t nloadsegs;
+	size_t nstacks;
+	size_t ntracestacks;
+	size_t nanomalies;
+	size_t nthreads;
+	size_t nmallocs;
+};
+
+static void
+ckpt_write(FILE *fp, const void *buf, size_t len, const char *file)
+{
+	if (len != 0 && fwrite(buf, len, 1, fp) != 1)
+		err(1, "%s", file);
+}
+
+static void
+ckpt_read(FILE *fp, void *buf, size_t len, const char *file)
+{
+	if (len != 0 && fread(buf, len, 1, fp) != 1) {
+		if (ferror(fp))
+			err(1, "%s", file);
+		errx(1, "%s: truncated checkpoint", file);
+	}
+}
+
+static FILE *ckfp;
+static const char *ckname;
+
+static void
+ckpt_writeanomaly(const struct anomaly *an, void *arg)
+{
+	size_t orig = an->orig == NULL ? SIZE_MAX : an->orig->id;
+
+	ckpt_write(ckfp, &an->kind, sizeof(an->kind), ckname);
+	ckpt_write(ckfp, &an->stack->id, sizeof(an->stack->id), ckname);
+	ckpt_write(ckfp, &orig, sizeof(orig), ckname);
+	ckpt_write(ckfp, &an->count, sizeof(an->count), ckname);
+	ckpt_write(ckfp, an->examples, sizeof(an->examples), ckname);
+}
+
+static void
+ckpt_writethread(const struct qthread *t, void *arg)
+{
+	ckpt_write(ckfp, &t->tid, sizeof(t->tid), ckname);
+	ckpt_write(ckfp, &t->nalloc, sizeof(t->nalloc), ckname);
+	ckpt_write(ckfp, &t->nfree, sizeof(t->nfree), ckname);
+	ckpt_write(ckfp, &t->allocated, sizeof(t->allocated), ckname);
+	ckpt_write(ckfp, &t->freed, sizeof(t->freed), ckname);
+}
+
+static void
+ckpt_writemalloc(const struct malloc *mptr, void *arg)
+{
+	ckpt_write(ckfp, &mptr->p, sizeof(mptr->p), ckname);
+	ckpt_write(ckfp, &mptr->size, sizeof(mptr->size), ckname);
+	ckpt_write(ckfp, &mptr->stack->id, sizeof(mptr->stack->id), ckname);
+	ckpt_write(ckfp, &mptr->time, sizeof(mptr->time), ckname);
+}
+
+/*
+ * Write the state as it is after replaying everything before offset.
+ * The file is replaced atomically, so a reader never sees half of it.
+ */
+void
+checkpoint_write(const char *file, off_t offset)
+{
+	struct ckpt_header hdr;
+	struct object *obj;
+	struct loadseg *seg;
+	struct stack *st;
+	const struct frame *f;
+	const char *str;
+	char tmp[PATH_MAX];
+	size_t i, j, len, id;
+	FILE *fp;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= sizeof(tmp))
+		errx(1, "%s: name too long", file);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		err(1, "%s", tmp);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+	hdr.start = ktr_start;
+	hdr.offset = offset;
+	hdr.pid = pid_seen;
+	hdr.mcur = mcur;
+	hdr.mmax = mmax;
+	hdr.samplerate = samplerate;
+	hdr.clock = traceclock;
+	hdr.now = tracenow;
+	hdr.growthevents = growthevents;
+	hdr.growthwindows = growthwindows;
+	hdr.peaktime = peaktime;
+	hdr.pagespeak = pagespeak;
+	hdr.pagespeakbytes = pagespeakbytes;
+	hdr.nsyms = nsyms;
+	hdr.nframes = nframes;
+	RB_FOREACH(obj, objectshead, &objects)
+		hdr.nobjects++;
+	hdr.nloadsegs = nloadsegs;
+	hdr.nstacks = nstacks;
+	hdr.ntracestacks = ntracestacks;
+	hdr.nanomalies = anomaly_count();
+	hdr.nthreads = query_nthreads();
+	hdr.nmallocs = live_count();
+	ckpt_write(fp, &hdr, sizeof(hdr), tmp);
+
+	for (i = 0; i < nsyms; i++) {
+		str = sym_str(i, &len);
+		ckpt_write(fp, &len, sizeof(len), tmp);
+		ckpt_write(fp, str, len, tmp);
+	}
+
+	for (i = 0; i < nframes; i++) {
+		f = frame_get(i);
+		ckpt_write(fp, f, sizeof(*f), tmp);
+	}
+
+	RB_FOREACH(obj, objectshead, &objects) {
+		ckpt_write(fp, &obj->f, sizeof(obj->f), tmp);
+		len = strlen(obj->fname);
+		ckpt_write(fp, &len, sizeof(len), tmp);
+		ckpt_write(fp, obj->fname, len, tmp);
+		ckpt_write(fp, &obj->frame, sizeof(obj->frame), tmp);
+	}
+
+	for (i = 0; i < nloadsegs; i++) {
+		seg = &loadsegs[i];
+		ckpt_write(fp, &seg->lo, sizeof(seg->lo), tmp);
+		ckpt_write(fp, &seg->hi, sizeof(seg->hi), tmp);
+		ckpt_write(fp, &seg->base, sizeof(seg->base), tmp);
+		ckpt_write(fp, &seg->idlen, sizeof(seg->idlen), tmp);
+		ckpt_write(fp, seg->id, seg->idlen, tmp);
+		len = strlen(seg->path);
+		ckpt_write(fp, &len, sizeof(len), tmp);
+		ckpt_write(fp, seg->path, len, tmp);
+	}
+
+	for (i = 0; i < nstacks; i++) {
+		st = stack_byid(i);
+		ckpt_write(fp, &st->nobj, sizeof(st->nobj), tmp);
+		ckpt_write(fp, &st->wcount, sizeof(st->wcount), tmp);
+		ckpt_write(fp, &st->cur, sizeof(st->cur), tmp);
+		ckpt_write(fp, &st->max, sizeof(st->max), tmp);
+		ckpt_write(fp, &st->nfreed, sizeof(st->nfreed), tmp);
+		ckpt_write(fp, &st->lifetime, sizeof(st->lifetime), tmp);
+		ckpt_write(fp, &st->growth, sizeof(st->growth), tmp);
+		for (j = 0; j < st->nobj; j++)
+			ckpt_write(fp, &st->obj[j]->f, sizeof(st->obj[j]->f),
+			    tmp);
+	}
+
+	for (i = 0; i < ntracestacks; i++) {
+		id = tracestacks[i] == NULL ? SIZE_MAX : tracestacks[i]->id;
+		ckpt_write(fp, &id, sizeof(id), tmp);
+	}
+
+	ckfp = fp;
+	ckname = tmp;
+	anomaly_foreach(ckpt_writeanomaly, NULL);
+	query_foreachthread(ckpt_writethread, NULL);
+	live_foreach(ckpt_writemalloc, NULL);
+
+	if (fclose(fp) == EOF)
+		err(1, "%s", tmp);
+	if (rename(tmp, file) == -1)
+		err(1, "rename %s", file);
+}
+
+/*
+ * Restore the state saved in file.  Returns the trace offset to continue
+ * from and the start record of the trace it belongs to.
+ */
+off_t
+checkpoint_read(const char *file, struct ktr_header *start)
+{
+	struct ckpt_header hdr;
+	struct object *obj, osearch, *frames[MAXFRAMES];
+	struct stack *st;
+	struct malloc m, dup;
+	struct anomaly an;
+	struct qthread t;
+	struct loadseg seg;
+	struct frame f;
+	char path[PATH_MAX], *str;
+	uint8_t buildid[KTR_USER_MAXLEN];
+	size_t i, j, len, id, nobj, *symmap, *framemap;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	ckpt_read(fp, &hdr, sizeof(hdr), file);
+	if (memcmp(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) != 0)
+		errx(1, "%s: not a checkpoint", file);
+	*start = hdr.start;
+	pid_seen = hdr.pid;
+	mcur = hdr.mcur;
+	mmax = hdr.mmax;
+	samplerate = hdr.samplerate;
+	traceclock = hdr.clock;
+	tracenow = hdr.now;
+	growthevents = hdr.growthevents;
+	growthwindows = hdr.growthwindows;
+	peaktime = hdr.peaktime;
+	/* The live allocations below only raise these. */
+	pagespeak = hdr.pagespeak;
+	pagespeakbytes = hdr.pagespeakbytes;
+
+	/*
+	 * The tables may already hold strings and frames, so the ids in
+	 * the file are mapped to the ones they get now.
+	 */
+	if ((symmap = calloc(hdr.nsyms, sizeof(*symmap))) == NULL ||
+	    (framemap = calloc(hdr.nframes, sizeof(*framemap))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < hdr.nsyms; i++) {
+		ckpt_read(fp, &len, sizeof(len), file);
+		if (len == SIZE_MAX)
+			errx(1, "%s: invalid string length", file);
+		str = xmalloc(len + 1);
+		ckpt_read(fp, str, len, file);
+		str[len] = '\0';
+		symmap[i] = sym_intern(str);
+		free(str);
+	}
+	for (i = 0; i < hdr.nframes; i++) {
+		ckpt_read(fp, &f, sizeof(f), file);
+		if (f.func >= hdr.nsyms || f.file >= hdr.nsyms ||
+		    (f.caller != FRAME_NONE && f.caller >= i))
+			errx(1, "%s: invalid frame", file);
+		f.func = symmap[f.func];
+		f.file = symmap[f.file];
+		if (f.caller != FRAME_NONE)
+			f.caller = framemap[f.caller];
+		framemap[i] = frame_intern(&f);
+	}
+
+	for (i = 0; i < hdr.nobjects; i++) {
+		obj = xmalloc(sizeof(*obj));
+		ckpt_read(fp, &obj->f, sizeof(obj->f), file);
+		ckpt_read(fp, &len, sizeof(len), file);
+		if (len >= sizeof(obj->fname))
+			errx(1, "%s: invalid path length", file);
+		ckpt_read(fp, obj->fname, len, file);
+		obj->fname[len] = '\0';
+		ckpt_read(fp, &obj->frame, sizeof(obj->frame), file);
+		if (obj->frame >= hdr.nframes)
+			errx(1, "%s: invalid frame id", file);
+		obj->frame = framemap[obj->frame];
+		if (RB_INSERT(objectshead, &objects, obj) != NULL)
+			errx(1, "%s: duplicate object", file);
+	}
+
+	for (i = 0; i < hdr.nloadsegs; i++) {
+		ckpt_read(fp, &seg.lo, sizeof(seg.lo), file);
+		ckpt_read(fp, &seg.hi, sizeof(seg.hi), file);
+		ckpt_read(fp, &seg.base, sizeof(seg.base), file);
+		ckpt_read(fp, &seg.idlen, sizeof(seg.idlen), file);
+		if (seg.idlen > sizeof(buildid))
+			errx(1, "%s: invalid build-id length", file);
+		ckpt_read(fp, buildid, seg.idlen, file);
+		ckpt_read(fp, &len, sizeof(len), file);
+		if (len >= sizeof(path))
+			errx(1, "%s: invalid path length", file);
+		ckpt_read(fp, path, len, file);
+		path[len] = '\0';
+		loadmap_insert(seg.lo, seg.hi, seg.base, buildid, seg.idlen,
+		    path);
+	}
+
+	for (i = 0; i < hdr.nstacks; i++) {
+		size_t cur, max, nfreed;
+		double wcount, lifetime;
+		struct growth growth;
+
+		ckpt_read(fp, &nobj, sizeof(nobj), file);
+		if (nobj > nitems(frames))
+			errx(1, "%s: invalid stack", file);
+		ckpt_read(fp, &wcount, sizeof(wcount), file);
+		ckpt_read(fp, &cur, sizeof(cur), file);
+		ckpt_read(fp, &max, sizeof(max), file);
+		ckpt_read(fp, &nfreed, sizeof(nfreed), file);
+		ckpt_read(fp, &lifetime, sizeof(lifetime), file);
+		ckpt_read(fp, &growth, sizeof(growth), file);
+		for (j = 0; j < nobj; j++) {
+			ckpt_read(fp, &osearch.f, sizeof(osearch.f), file);
+			if ((frames[j] = RB_FIND(objectshead, &objects,
+			    &osearch)) == NULL)
+				errx(1, "%s: unknown frame", file);
+		}
+		/* Interning in order of id hands out the same ids again. */
+		st = stack_intern(frames, nobj);
+		if (st->id != i)
+			errx(1, "%s: duplicate stack", file);
+		st->wcount = wcount;
+		st->count = wcount + 0.5;
+		st->cur = cur;
+		st->max = max;
+		st->nfreed = nfreed;
+		st->lifetime = lifetime;
+		st->growth = growth;
+	}
+
+	for (i = 0; i < hdr.ntracestacks; i++) {
+		ckpt_read(fp, &id, sizeof(id), file);
+		if (id == SIZE_MAX)
+			continue;
+		if (id >= hdr.nstacks)
+			errx(1, "%s: invalid stack id", file);
+		stack_settrace(i, stack_byid(id));
+	}
+
+	for (i = 0; i < hdr.nanomalies; i++) {
+		memset(&an, 0, sizeof(an));
+		ckpt_read(fp, &an.kind, sizeof(an.kind), file);
+		ckpt_read(fp, &id, sizeof(id), file);
+		if (an.kind < 0 || an.kind >= ANOMALY_MAX || id >= hdr.nstacks)
+			errx(1, "%s: invalid anomaly", file);
+		an.stack = stack_byid(id);
+		ckpt_read(fp, &id, sizeof(id), file);
+		if (id != SIZE_MAX && id >= hdr.nstacks)
+			errx(1, "%s: invalid stack id", file);
+		an.orig = id == SIZE_MAX ? NULL : stack_byid(id);
+		ckpt_read(fp, &an.count, sizeof(an.count), file);
+		ckpt_read(fp, an.examples, sizeof(an.examples), file);
+		anomaly_restore(&an);
+	}
+
+	for (i = 0; i < hdr.nthreads; i++) {
+		memset(&t, 0, sizeof(t));
+		ckpt_read(fp, &t.tid, sizeof(t.tid), file);
+		ckpt_read(fp, &t.nalloc, sizeof(t.nalloc), file);
+		ckpt_read(fp, &t.nfree, sizeof(t.nfree), file);
+		ckpt_read(fp, &t.allocated, sizeof(t.allocated), file);
+		ckpt_read(fp, &t.freed, sizeof(t.freed), file);
+		query_restorethread(&t);
+	}
+
+	for (i = 0; i < hdr.nmallocs; i++) {
+		ckpt_read(fp, &m.p, sizeof(m.p), file);
+		ckpt_read(fp, &m.size, sizeof(m.size), file);
+		ckpt_read(fp, &id, sizeof(id), file);
+		if (id >= hdr.nstacks)
+			errx(1, "%s: invalid stack id", file);
+		m.stack = stack_byid(id);
+		ckpt_read(fp, &m.time, sizeof(m.time), file);
+		if (!live_insert(&m, &dup))
+			errx(1, "%s: duplicate allocation", file);
+	}
+
+	free(symmap);
+	free(framemap);
+	fclose(fp);
+	return hdr.offset;
+}
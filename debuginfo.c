@@ -0,0 +1,1753 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A small DWARF decoder for the common case, used by addr2line() before
+ * it falls back to libdwarf.  An object is mapped once and stays mapped;
+ * opening it only reads the unit headers, their root DIEs and
+ * .debug_aranges to know which unit covers which addresses.  A unit is
+ * decoded the first time an address in it is looked up, into two flat
+ * tables: the rows of its line program, sorted by address, and the
+ * address ranges of its subprograms and inlined subroutines, with the
+ * one each was inlined into.  Nothing is copied out of the mapping but
+ * those tables; names point into it.
+ *
+ * DWARF 2 to 5 in 64-bit ELF files of the native byte order are handled.
+ * Anything else, such as compressed sections, split DWARF or an unknown
+ * form, makes the lookup return 0, and libdwarf is used instead.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/tree.h>
+
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdump.h"
+
+#ifndef SHF_COMPRESSED
+#define SHF_COMPRESSED	0x800
+#endif
+
+#define DW_TAG_entry_point		0x03
+#define DW_TAG_compile_unit		0x11
+#define DW_TAG_inlined_subroutine	0x1d
+#define DW_TAG_subprogram		0x2e
+#define DW_TAG_partial_unit		0x3c
+
+#define DW_AT_name		0x03
+#define DW_AT_stmt_list		0x10
+#define DW_AT_low_pc		0x11
+#define DW_AT_high_pc		0x12
+#define DW_AT_comp_dir		0x1b
+#define DW_AT_abstract_origin	0x31
+#define DW_AT_specification	0x47
+#define DW_AT_ranges		0x55
+#define DW_AT_call_file		0x58
+#define DW_AT_call_line		0x59
+#define DW_AT_str_offsets_base	0x72
+#define DW_AT_addr_base		0x73
+#define DW_AT_rnglists_base	0x74
+
+#define DW_FORM_addr		0x01
+#define DW_FORM_block2		0x03
+#define DW_FORM_block4		0x04
+#define DW_FORM_data2		0x05
+#define DW_FORM_data4		0x06
+#define DW_FORM_data8		0x07
+#define DW_FORM_string		0x08
+#define DW_FORM_block		0x09
+#define DW_FORM_block1		0x0a
+#define DW_FORM_data1		0x0b
+#define DW_FORM_flag		0x0c
+#define DW_FORM_sdata		0x0d
+#define DW_FORM_strp		0x0e
+#define DW_FORM_udata		0x0f
+#define DW_FORM_ref_addr	0x10
+#define DW_FORM_ref1		0x11
+#define DW_FORM_ref2		0x12
+#define DW_FORM_ref4		0x13
+#define DW_FORM_ref8		0x14
+#define DW_FORM_ref_udata	0x15
+#define DW_FORM_indirect	0x16
+#define DW_FORM_sec_offset	0x17
+#define DW_FORM_exprloc		0x18
+#define DW_FORM_flag_present	0x19
+#define DW_FORM_strx		0x1a
+#define DW_FORM_addrx		0x1b
+#define DW_FORM_ref_sup4	0x1c
+#define DW_FORM_data16		0x1e
+#define DW_FORM_line_strp	0x1f
+#define DW_FORM_ref_sig8	0x20
+#define DW_FORM_implicit_const	0x21
+#define DW_FORM_loclistx	0x22
+#define DW_FORM_rnglistx	0x23
+#define DW_FORM_ref_sup8	0x24
+#define DW_FORM_strx1		0x25
+#define DW_FORM_strx2		0x26
+#define DW_FORM_strx3		0x27
+#define DW_FORM_strx4		0x28
+#define DW_FORM_addrx1		0x29
+#define DW_FORM_addrx2		0x2a
+#define DW_FORM_addrx3		0x2b
+#define DW_FORM_addrx4		0x2c
+
+#define DW_UT_compile		0x01
+#define DW_UT_type		0x02
+#define DW_UT_partial		0x03
+#define DW_UT_split_type	0x06
+
+#define DW_LNS_copy		0x01
+#define DW_LNS_advance_pc	0x02
+#define DW_LNS_advance_line	0x03
+#define DW_LNS_set_file		0x04
+#define DW_LNS_const_add_pc	0x08
+#define DW_LNS_fixed_advance_pc	0x09
+
+#define DW_LNE_end_sequence	0x01
+#define DW_LNE_set_address	0x02
+#define DW_LNE_define_file	0x03
+
+#define DW_LNCT_path		0x01
+#define DW_LNCT_directory_index	0x02
+
+#define DW_RLE_end_of_list	0x00
+#define DW_RLE_base_addressx	0x01
+#define DW_RLE_startx_endx	0x02
+#define DW_RLE_startx_length	0x03
+#define DW_RLE_offset_pair	0x04
+#define DW_RLE_base_address	0x05
+#define DW_RLE_start_end	0x06
+#define DW_RLE_start_length	0x07
+
+#define DI_MAXDEPTH	256	/* of the DIE tree */
+#define DI_MAXHOPS	8	/* abstract origins followed for a name */
+
+#define LROW_END	UINT32_MAX	/* file of a row ending a sequence */
+#define FUNC_NONE	UINT32_MAX
+
+struct section {
+	const uint8_t *p;
+	size_t len;
+};
+
+struct buf {
+	const uint8_t *p;
+	const uint8_t *end;
+	int err;
+};
+
+struct abbrevattr {
+	uint64_t name;
+	uint64_t form;
+	int64_t implicit;	/* DW_FORM_implicit_const */
+};
+
+struct abbrev {
+	uint64_t code;
+	uint64_t tag;
+	int children;
+	size_t attr;		/* index of the first in attrs */
+	size_t nattrs;
+};
+
+struct attr {
+	uint64_t name;
+	uint64_t form;
+	uint64_t u;		/* value, offset or index */
+	const char *s;		/* inline string */
+};
+
+struct lrow {
+	uint64_t addr;
+	uint32_t file;		/* or LROW_END */
+	uint32_t line;
+};
+
+struct lseq {
+	uint64_t lo;
+	size_t start;
+	size_t n;
+};
+
+struct func {
+	uint64_t lo;
+	uint64_t hi;
+	const char *name;
+	uint32_t parent;	/* enclosing function, or FUNC_NONE */
+	uint32_t call_file;
+	uint32_t call_line;
+	uint16_t depth;
+	uint8_t inlined;
+};
+
+/* An entry of funcs, in the order of addresses. */
+struct frange {
+	uint64_t lo;
+	uint64_t maxhi;		/* of this and all before */
+	uint32_t func;
+};
+
+enum { UNIT_NEW, UNIT_ROOT, UNIT_DECODED, UNIT_FAILED };
+
+struct unit {
+	uint64_t off;		/* of the header in .debug_info */
+	uint64_t end;
+	uint64_t dieoff;	/* of the root DIE */
+	uint64_t abbrevoff;
+	int version;
+	int type;
+	int offsize;
+	int addrsize;
+	int state;
+	int covered;		/* by .debug_aranges */
+	uint64_t base;		/* for range lists */
+	uint64_t addrbase;
+	uint64_t stroffbase;
+	uint64_t rnglistsbase;
+	uint64_t stmtlist;
+	int hasstmt;
+	const char *compdir;
+	struct abbrev *abbrevs;
+	size_t nabbrevs;
+	struct abbrevattr *attrs;
+	struct lrow *rows;
+	size_t nrows;
+	size_t *files;		/* string ids, by line program index */
+	size_t nfiles;
+	struct func *funcs;
+	size_t nfuncs;
+	size_t funcssize;
+	struct frange *franges;
+};
+
+struct arange {
+	uint64_t lo;
+	uint64_t hi;
+	size_t unit;
+};
+
+struct dbgobj {
+	const char *path;
+	uint8_t *map;
+	size_t maplen;
+	int failed;
+	struct section info, abbrev, line, str, linestr, aranges, ranges,
+	    rnglists, addr, stroff;
+	struct unit *units;	/* by offset */
+	size_t nunits;
+	struct arange *ars;	/* by lo */
+	size_t nars;
+	size_t arssize;
+	RB_ENTRY(dbgobj) entry;
+};
+
+RB_HEAD(dbgobjs, dbgobj);
+RB_PROTOTYPE_STATIC(dbgobjs, dbgobj, entry, dbgobjcmp)
+
+static struct dbgobjs dbgobjs = RB_INITIALIZER(&dbgobjs);
+
+static int
+dbgobjcmp(const struct dbgobj *o1, const struct dbgobj *o2)
+{
+	return strcmp(o1->path, o2->path);
+}
+
+/*
+ * Bounds checked reading.  An overrun sets err and makes every read
+ * after it return 0.
+ */
+static void
+buf_init(struct buf *b, const struct section *s, uint64_t off, uint64_t len)
+{
+	if (off > s->len || len > s->len - off) {
+		b->p = b->end = NULL;
+		b->err = 1;
+		return;
+	}
+	b->p = s->p + off;
+	b->end = b->p + len;
+	b->err = 0;
+}
+
+static void
+buf_skip(struct buf *b, uint64_t n)
+{
+	if (b->err || (uint64_t)(b->end - b->p) < n) {
+		b->err = 1;
+		b->p = b->end;
+		return;
+	}
+	b->p += n;
+}
+
+static uint64_t
+get_uint(struct buf *b, size_t n)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	if (b->err || (size_t)(b->end - b->p) < n) {
+		b->err = 1;
+		b->p = b->end;
+		return 0;
+	}
+#if BYTE_ORDER == LITTLE_ENDIAN
+	for (i = n; i-- > 0;)
+		v = v << 8 | b->p[i];
+#else
+	for (i = 0; i < n; i++)
+		v = v << 8 | b->p[i];
+#endif
+	b->p += n;
+	return v;
+}
+
+static uint64_t
+get_uleb(struct buf *b)
+{
+	uint64_t v = 0;
+	unsigned int shift = 0;
+	uint8_t c;
+
+	do {
+		if (b->err || b->p >= b->end) {
+			b->err = 1;
+			return 0;
+		}
+		c = *b->p++;
+		if (shift < 64)
+			v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return v;
+}
+
+static int64_t
+get_sleb(struct buf *b)
+{
+	uint64_t v = 0;
+	unsigned int shift = 0;
+	uint8_t c;
+
+	do {
+		if (b->err || b->p >= b->end) {
+			b->err = 1;
+			return 0;
+		}
+		c = *b->p++;
+		if (shift < 64)
+			v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	if (shift < 64 && (c & 0x40))
+		v |= -((uint64_t)1 << shift);
+	return (int64_t)v;
+}
+
+static const char *
+get_str(struct buf *b)
+{
+	const uint8_t *nul;
+	const char *s;
+
+	if (b->err || (nul = memchr(b->p, '\0', b->end - b->p)) == NULL) {
+		b->err = 1;
+		b->p = b->end;
+		return NULL;
+	}
+	s = (const char *)b->p;
+	b->p = nul + 1;
+	return s;
+}
+
+/*
+ * An initial length field; sets the size of offsets, 4 or 8.
+ */
+static uint64_t
+get_length(struct buf *b, int *offsize)
+{
+	uint64_t len;
+
+	*offsize = 4;
+	len = get_uint(b, 4);
+	if (len == 0xffffffff) {
+		*offsize = 8;
+		len = get_uint(b, 8);
+	} else if (len >= 0xfffffff0)
+		b->err = 1;
+	return len;
+}
+
+static const char *
+sec_str(const struct section *s, uint64_t off)
+{
+	if (off >= s->len || memchr(s->p + off, '\0', s->len - off) == NULL)
+		return NULL;
+	return (const char *)s->p + off;
+}
+
+/*
+ * Map path and find the debug sections.  Returns 0 if it isn't a file
+ * this decoder handles.
+ */
+static int
+dbgobj_map(struct dbgobj *o)
+{
+	const Elf64_Ehdr *eh;
+	const Elf64_Shdr *sh, *shstr;
+	const char *name;
+	struct section *sec;
+	struct stat st;
+	size_t i;
+	int fd;
+
+	if ((fd = open(o->path, O_RDONLY)) == -1)
+		return 0;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*eh) ||
+	    (uint64_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		return 0;
+	}
+	o->maplen = st.st_size;
+	o->map = mmap(NULL, o->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (o->map == MAP_FAILED) {
+		o->map = NULL;
+		return 0;
+	}
+	a2lstats.opened++;
+
+	eh = (const Elf64_Ehdr *)o->map;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+#if BYTE_ORDER == LITTLE_ENDIAN
+	    eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+#else
+	    eh->e_ident[EI_DATA] != ELFDATA2MSB ||
+#endif
+	    (eh->e_type != ET_EXEC && eh->e_type != ET_DYN) ||
+	    eh->e_shentsize != sizeof(*sh) || eh->e_shoff > o->maplen ||
+	    eh->e_shnum > (o->maplen - eh->e_shoff) / sizeof(*sh) ||
+	    eh->e_shstrndx >= eh->e_shnum)
+		return 0;
+	sh = (const Elf64_Shdr *)(o->map + eh->e_shoff);
+	shstr = &sh[eh->e_shstrndx];
+	if (shstr->sh_offset > o->maplen ||
+	    shstr->sh_size > o->maplen - shstr->sh_offset)
+		return 0;
+
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_name >= shstr->sh_size)
+			continue;
+		name = (const char *)o->map + shstr->sh_offset + sh[i].sh_name;
+		if (memchr(name, '\0', shstr->sh_size - sh[i].sh_name) == NULL)
+			continue;
+		if (strncmp(name, ".zdebug_", 8) == 0)
+			return 0;
+		if (strncmp(name, ".debug_", 7) != 0)
+			continue;
+		name += 7;
+		if (strcmp(name, "info") == 0)
+			sec = &o->info;
+		else if (strcmp(name, "abbrev") == 0)
+			sec = &o->abbrev;
+		else if (strcmp(name, "line") == 0)
+			sec = &o->line;
+		else if (strcmp(name, "str") == 0)
+			sec = &o->str;
+		else if (strcmp(name, "line_str") == 0)
+			sec = &o->linestr;
+		else if (strcmp(name, "aranges") == 0)
+			sec = &o->aranges;
+		else if (strcmp(name, "ranges") == 0)
+			sec = &o->ranges;
+		else if (strcmp(name, "rnglists") == 0)
+			sec = &o->rnglists;
+		else if (strcmp(name, "addr") == 0)
+			sec = &o->addr;
+		else if (strcmp(name, "str_offsets") == 0)
+			sec = &o->stroff;
+		else
+			continue;
+		if (sh[i].sh_type == SHT_NOBITS)
+			continue;
+		if ((sh[i].sh_flags & SHF_COMPRESSED) ||
+		    sh[i].sh_offset > o->maplen ||
+		    sh[i].sh_size > o->maplen - sh[i].sh_offset)
+			return 0;
+		sec->p = o->map + sh[i].sh_offset;
+		sec->len = sh[i].sh_size;
+	}
+	return o->info.len != 0 && o->abbrev.len != 0;
+}
+
+static struct unit *
+unit_byoff(struct dbgobj *o, uint64_t off)
+{
+	size_t lo = 0, hi = o->nunits, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (off < o->units[mid].off)
+			hi = mid;
+		else if (off >= o->units[mid].end)
+			lo = mid + 1;
+		else
+			return &o->units[mid];
+	}
+	return NULL;
+}
+
+static int
+abbrevcmp(const void *a, const void *b)
+{
+	const struct abbrev *a1 = a, *a2 = b;
+
+	return a1->code < a2->code ? -1 : a1->code > a2->code;
+}
+
+static int
+abbrev_parse(struct dbgobj *o, struct unit *u)
+{
+	struct abbrev *ab;
+	struct abbrevattr *at;
+	struct buf b;
+	size_t size = 0, attrsize = 0, nattrs = 0, i;
+	uint64_t code, name, form;
+
+	buf_init(&b, &o->abbrev, u->abbrevoff, o->abbrev.len - MIN(u->abbrevoff,
+	    o->abbrev.len));
+	while ((code = get_uleb(&b)) != 0) {
+		if (u->nabbrevs == size) {
+			size = size == 0 ? 64 : size * 2;
+			if ((u->abbrevs = reallocarray(u->abbrevs, size,
+			    sizeof(*u->abbrevs))) == NULL)
+				err(1, NULL);
+		}
+		ab = &u->abbrevs[u->nabbrevs++];
+		ab->code = code;
+		ab->tag = get_uleb(&b);
+		ab->children = get_uint(&b, 1);
+		ab->attr = nattrs;
+		for (;;) {
+			name = get_uleb(&b);
+			form = get_uleb(&b);
+			if (b.err || (name == 0 && form == 0))
+				break;
+			if (nattrs == attrsize) {
+				attrsize = attrsize == 0 ? 256 : attrsize * 2;
+				if ((u->attrs = reallocarray(u->attrs,
+				    attrsize, sizeof(*u->attrs))) == NULL)
+					err(1, NULL);
+			}
+			at = &u->attrs[nattrs++];
+			at->name = name;
+			at->form = form;
+			at->implicit = form == DW_FORM_implicit_const ?
+			    get_sleb(&b) : 0;
+		}
+		ab->nattrs = nattrs - ab->attr;
+		if (b.err)
+			return 0;
+	}
+	if (b.err)
+		return 0;
+
+	/* Codes are usually 1 to n already. */
+	for (i = 0; i < u->nabbrevs; i++)
+		if (u->abbrevs[i].code != i + 1)
+			break;
+	if (i != u->nabbrevs)
+		qsort(u->abbrevs, u->nabbrevs, sizeof(*u->abbrevs),
+		    abbrevcmp);
+	return 1;
+}
+
+static const struct abbrev *
+abbrev_find(const struct unit *u, uint64_t code)
+{
+	size_t lo = 0, hi = u->nabbrevs, mid;
+
+	if (code - 1 < u->nabbrevs && u->abbrevs[code - 1].code == code)
+		return &u->abbrevs[code - 1];
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (code < u->abbrevs[mid].code)
+			hi = mid;
+		else if (code > u->abbrevs[mid].code)
+			lo = mid + 1;
+		else
+			return &u->abbrevs[mid];
+	}
+	return NULL;
+}
+
+/*
+ * Read an attribute value.  Strings, addresses and references are
+ * resolved later, when the bases of the unit are known.
+ */
+static void
+form_read(const struct unit *u, struct buf *b, uint64_t form,
+    int64_t implicit, struct attr *a)
+{
+	a->form = form;
+	a->u = 0;
+	a->s = NULL;
+	switch (form) {
+	case DW_FORM_addr:
+		a->u = get_uint(b, u->addrsize);
+		break;
+	case DW_FORM_block1:
+		buf_skip(b, get_uint(b, 1));
+		break;
+	case DW_FORM_block2:
+		buf_skip(b, get_uint(b, 2));
+		break;
+	case DW_FORM_block4:
+		buf_skip(b, get_uint(b, 4));
+		break;
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		buf_skip(b, get_uleb(b));
+		break;
+	case DW_FORM_data1:
+	case DW_FORM_ref1:
+	case DW_FORM_flag:
+	case DW_FORM_strx1:
+	case DW_FORM_addrx1:
+		a->u = get_uint(b, 1);
+		break;
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+	case DW_FORM_strx2:
+	case DW_FORM_addrx2:
+		a->u = get_uint(b, 2);
+		break;
+	case DW_FORM_strx3:
+	case DW_FORM_addrx3:
+		a->u = get_uint(b, 3);
+		break;
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+	case DW_FORM_ref_sup4:
+	case DW_FORM_strx4:
+	case DW_FORM_addrx4:
+		a->u = get_uint(b, 4);
+		break;
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_sig8:
+	case DW_FORM_ref_sup8:
+		a->u = get_uint(b, 8);
+		break;
+	case DW_FORM_data16:
+		buf_skip(b, 16);
+		break;
+	case DW_FORM_sdata:
+		a->u = get_sleb(b);
+		break;
+	case DW_FORM_udata:
+	case DW_FORM_ref_udata:
+	case DW_FORM_strx:
+	case DW_FORM_addrx:
+	case DW_FORM_loclistx:
+	case DW_FORM_rnglistx:
+		a->u = get_uleb(b);
+		break;
+	case DW_FORM_string:
+		a->s = get_str(b);
+		break;
+	case DW_FORM_strp:
+	case DW_FORM_line_strp:
+	case DW_FORM_sec_offset:
+		a->u = get_uint(b, u->offsize);
+		break;
+	case DW_FORM_ref_addr:
+		/* An address sized offset before DWARF 3. */
+		a->u = get_uint(b, u->version == 2 ? u->addrsize : u->offsize);
+		break;
+	case DW_FORM_flag_present:
+		a->u = 1;
+		break;
+	case DW_FORM_implicit_const:
+		a->u = implicit;
+		break;
+	case DW_FORM_indirect:
+		form_read(u, b, get_uleb(b), 0, a);
+		break;
+	default:
+		/* GNU extensions and whatever comes next. */
+		b->err = 1;
+		break;
+	}
+}
+
+static const char *
+attr_str(const struct dbgobj *o, const struct unit *u, const struct attr *a)
+{
+	struct buf b;
+
+	switch (a->form) {
+	case DW_FORM_string:
+		return a->s;
+	case DW_FORM_strp:
+		return sec_str(&o->str, a->u);
+	case DW_FORM_line_strp:
+		return sec_str(&o->linestr, a->u);
+	case DW_FORM_strx:
+	case DW_FORM_strx1:
+	case DW_FORM_strx2:
+	case DW_FORM_strx3:
+	case DW_FORM_strx4:
+		buf_init(&b, &o->stroff, u->stroffbase + a->u * u->offsize,
+		    u->offsize);
+		return b.err ? NULL : sec_str(&o->str, get_uint(&b,
+		    u->offsize));
+	default:
+		return NULL;
+	}
+}
+
+static int
+attr_addr(const struct dbgobj *o, const struct unit *u, const struct attr *a,
+    uint64_t *addr)
+{
+	struct buf b;
+
+	switch (a->form) {
+	case DW_FORM_addr:
+		*addr = a->u;
+		return 1;
+	case DW_FORM_addrx:
+	case DW_FORM_addrx1:
+	case DW_FORM_addrx2:
+	case DW_FORM_addrx3:
+	case DW_FORM_addrx4:
+		buf_init(&b, &o->addr, u->addrbase + a->u * u->addrsize,
+		    u->addrsize);
+		*addr = get_uint(&b, u->addrsize);
+		return !b.err;
+	default:
+		return 0;
+	}
+}
+
+static int
+attr_const(const struct attr *a)
+{
+	switch (a->form) {
+	case DW_FORM_data1:
+	case DW_FORM_data2:
+	case DW_FORM_data4:
+	case DW_FORM_data8:
+	case DW_FORM_sdata:
+	case DW_FORM_udata:
+	case DW_FORM_implicit_const:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The offset in .debug_info a reference points to, or 0.
+ */
+static uint64_t
+attr_ref(const struct unit *u, const struct attr *a)
+{
+	switch (a->form) {
+	case DW_FORM_ref1:
+	case DW_FORM_ref2:
+	case DW_FORM_ref4:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_udata:
+		return u->off + a->u;
+	case DW_FORM_ref_addr:
+		return a->u;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The attributes of a DIE this decoder cares about.
+ */
+struct die {
+	uint64_t tag;
+	const struct abbrev *ab;
+	struct attr name, lowpc, highpc, ranges, origin, spec, callfile,
+	    callline, compdir, stmtlist, addrbase, stroffbase, rnglistsbase;
+	unsigned int has;	/* bits of DIE_* */
+};
+
+#define DIE_NAME	0x0001
+#define DIE_LOWPC	0x0002
+#define DIE_HIGHPC	0x0004
+#define DIE_RANGES	0x0008
+#define DIE_ORIGIN	0x0010
+#define DIE_SPEC	0x0020
+#define DIE_CALLFILE	0x0040
+#define DIE_CALLLINE	0x0080
+#define DIE_COMPDIR	0x0100
+#define DIE_STMTLIST	0x0200
+#define DIE_ADDRBASE	0x0400
+#define DIE_STROFFBASE	0x0800
+#define DIE_RNGLISTSBASE 0x1000
+
+/*
+ * Read the DIE at b.  Returns 0 at the end of a list of siblings, -1 on
+ * errors.
+ */
+static int
+die_read(const struct unit *u, struct buf *b, struct die *d)
+{
+	const struct abbrevattr *at;
+	struct attr a, *dst;
+	uint64_t code;
+	unsigned int bit;
+	size_t i;
+
+	if ((code = get_uleb(b)) == 0)
+		return b->err ? -1 : 0;
+	if ((d->ab = abbrev_find(u, code)) == NULL)
+		return -1;
+	d->tag = d->ab->tag;
+	d->has = 0;
+	for (i = 0; i < d->ab->nattrs; i++) {
+		at = &u->attrs[d->ab->attr + i];
+		form_read(u, b, at->form, at->implicit, &a);
+		switch (at->name) {
+		case DW_AT_name:
+			dst = &d->name, bit = DIE_NAME;
+			break;
+		case DW_AT_low_pc:
+			dst = &d->lowpc, bit = DIE_LOWPC;
+			break;
+		case DW_AT_high_pc:
+			dst = &d->highpc, bit = DIE_HIGHPC;
+			break;
+		case DW_AT_ranges:
+			dst = &d->ranges, bit = DIE_RANGES;
+			break;
+		case DW_AT_abstract_origin:
+			dst = &d->origin, bit = DIE_ORIGIN;
+			break;
+		case DW_AT_specification:
+			dst = &d->spec, bit = DIE_SPEC;
+			break;
+		case DW_AT_call_file:
+			dst = &d->callfile, bit = DIE_CALLFILE;
+			break;
+		case DW_AT_call_line:
+			dst = &d->callline, bit = DIE_CALLLINE;
+			break;
+		case DW_AT_comp_dir:
+			dst = &d->compdir, bit = DIE_COMPDIR;
+			break;
+		case DW_AT_stmt_list:
+			dst = &d->stmtlist, bit = DIE_STMTLIST;
+			break;
+		case DW_AT_addr_base:
+			dst = &d->addrbase, bit = DIE_ADDRBASE;
+			break;
+		case DW_AT_str_offsets_base:
+			dst = &d->stroffbase, bit = DIE_STROFFBASE;
+			break;
+		case DW_AT_rnglists_base:
+			dst = &d->rnglistsbase, bit = DIE_RNGLISTSBASE;
+			break;
+		default:
+			continue;
+		}
+		*dst = a;
+		dst->name = at->name;
+		d->has |= bit;
+	}
+	return b->err ? -1 : 1;
+}
+
+/*
+ * Call fn for every address range of a DIE.  Returns 0 on errors.
+ */
+static int
+die_ranges(const struct dbgobj *o, const struct unit *u, const struct die *d,
+    void (*fn)(uint64_t, uint64_t, void *), void *arg)
+{
+	struct attr a;
+	struct buf b;
+	uint64_t lo, hi, base = u->base, off, max;
+	uint8_t kind;
+
+	if (d->has & DIE_RANGES) {
+		off = d->ranges.u;
+		if (u->version < 5) {
+			max = u->addrsize == 8 ? UINT64_MAX : UINT32_MAX;
+			buf_init(&b, &o->ranges, off, o->ranges.len -
+			    MIN(off, o->ranges.len));
+			for (;;) {
+				lo = get_uint(&b, u->addrsize);
+				hi = get_uint(&b, u->addrsize);
+				if (b.err)
+					return 0;
+				if (lo == 0 && hi == 0)
+					return 1;
+				if (lo == max)
+					base = hi;
+				else if (lo < hi)
+					fn(base + lo, base + hi, arg);
+			}
+		}
+		if (d->ranges.form == DW_FORM_rnglistx) {
+			buf_init(&b, &o->rnglists, u->rnglistsbase +
+			    off * u->offsize, u->offsize);
+			off = u->rnglistsbase + get_uint(&b, u->offsize);
+			if (b.err)
+				return 0;
+		}
+		buf_init(&b, &o->rnglists, off, o->rnglists.len -
+		    MIN(off, o->rnglists.len));
+		for (;;) {
+			kind = get_uint(&b, 1);
+			a.form = DW_FORM_addrx;
+			switch (kind) {
+			case DW_RLE_end_of_list:
+				return !b.err;
+			case DW_RLE_base_addressx:
+				a.u = get_uleb(&b);
+				if (!attr_addr(o, u, &a, &base))
+					return 0;
+				continue;
+			case DW_RLE_startx_endx:
+				a.u = get_uleb(&b);
+				if (!attr_addr(o, u, &a, &lo))
+					return 0;
+				a.u = get_uleb(&b);
+				if (!attr_addr(o, u, &a, &hi))
+					return 0;
+				break;
+			case DW_RLE_startx_length:
+				a.u = get_uleb(&b);
+				if (!attr_addr(o, u, &a, &lo))
+					return 0;
+				hi = lo + get_uleb(&b);
+				break;
+			case DW_RLE_offset_pair:
+				lo = base + get_uleb(&b);
+				hi = base + get_uleb(&b);
+				break;
+			case DW_RLE_base_address:
+				base = get_uint(&b, u->addrsize);
+				continue;
+			case DW_RLE_start_end:
+				lo = get_uint(&b, u->addrsize);
+				hi = get_uint(&b, u->addrsize);
+				break;
+			case DW_RLE_start_length:
+				lo = get_uint(&b, u->addrsize);
+				hi = lo + get_uleb(&b);
+				break;
+			default:
+				return 0;
+			}
+			if (b.err)
+				return 0;
+			if (lo < hi)
+				fn(lo, hi, arg);
+		}
+	}
+
+	if ((d->has & (DIE_LOWPC | DIE_HIGHPC)) != (DIE_LOWPC | DIE_HIGHPC))
+		return 1;
+	if (!attr_addr(o, u, &d->lowpc, &lo))
+		return 0;
+	if (attr_const(&d->highpc))
+		hi = lo + d->highpc.u;
+	else if (!attr_addr(o, u, &d->highpc, &hi))
+		return 0;
+	if (lo < hi)
+		fn(lo, hi, arg);
+	return 1;
+}
+
+static void
+arange_add(struct dbgobj *o, uint64_t lo, uint64_t hi, size_t unit)
+{
+	if (o->nars == o->arssize) {
+		o->arssize = o->arssize == 0 ? 256 : o->arssize * 2;
+		if ((o->ars = reallocarray(o->ars, o->arssize,
+		    sizeof(*o->ars))) == NULL)
+			err(1, NULL);
+	}
+	o->ars[o->nars].lo = lo;
+	o->ars[o->nars].hi = hi;
+	o->ars[o->nars].unit = unit;
+	o->nars++;
+}
+
+struct rootarg {
+	struct dbgobj *o;
+	size_t unit;
+};
+
+static void
+root_range(uint64_t lo, uint64_t hi, void *arg)
+{
+	struct rootarg *ra = arg;
+
+	arange_add(ra->o, lo, hi, ra->unit);
+}
+
+/*
+ * Read the root DIE of a unit, for the bases the other DIEs need and,
+ * unless .debug_aranges covered the unit, its address ranges.
+ */
+static int
+unit_root(struct dbgobj *o, size_t i)
+{
+	struct unit *u = &o->units[i];
+	struct rootarg ra;
+	struct buf b;
+	struct die d;
+
+	if (!abbrev_parse(o, u))
+		return 0;
+	buf_init(&b, &o->info, u->dieoff, u->end - u->dieoff);
+	if (die_read(u, &b, &d) != 1 || (d.tag != DW_TAG_compile_unit &&
+	    d.tag != DW_TAG_partial_unit))
+		return 0;
+
+	/* Defaults for producers that leave the bases out. */
+	u->stroffbase = u->version >= 5 ? 2 * u->offsize : 0;
+	u->addrbase = u->version >= 5 ? 2 * u->offsize : 0;
+	/* Length, version, sizes and offset count: 12 or 20 bytes. */
+	u->rnglistsbase = u->version >= 5 ? (u->offsize == 8 ? 20 : 12) : 0;
+	if (d.has & DIE_STROFFBASE)
+		u->stroffbase = d.stroffbase.u;
+	if (d.has & DIE_ADDRBASE)
+		u->addrbase = d.addrbase.u;
+	if (d.has & DIE_RNGLISTSBASE)
+		u->rnglistsbase = d.rnglistsbase.u;
+	if (d.has & DIE_COMPDIR)
+		u->compdir = attr_str(o, u, &d.compdir);
+	if (d.has & DIE_STMTLIST) {
+		u->stmtlist = d.stmtlist.u;
+		u->hasstmt = 1;
+	}
+	u->base = 0;
+	if ((d.has & DIE_LOWPC) && !attr_addr(o, u, &d.lowpc, &u->base))
+		return 0;
+	u->state = UNIT_ROOT;
+
+	if (u->covered)
+		return 1;
+	ra.o = o;
+	ra.unit = i;
+	return die_ranges(o, u, &d, root_range, &ra);
+}
+
+static int
+arangecmp(const void *a, const void *b)
+{
+	const struct arange *a1 = a, *a2 = b;
+
+	return a1->lo < a2->lo ? -1 : a1->lo > a2->lo;
+}
+
+/*
+ * Read .debug_aranges, and mark the units it covers.
+ */
+static int
+aranges_read(struct dbgobj *o)
+{
+	struct unit *u;
+	struct buf b, set;
+	uint64_t len, off, lo, size;
+	int offsize, addrsize, version;
+	size_t start;
+
+	buf_init(&b, &o->aranges, 0, o->aranges.len);
+	while (b.p < b.end) {
+		start = b.p - o->aranges.p;
+		len = get_length(&b, &offsize);
+		set = b;
+		set.end = b.p + MIN(len, (uint64_t)(b.end - b.p));
+		buf_skip(&b, len);
+		if (b.err)
+			return 0;
+		version = get_uint(&set, 2);
+		off = get_uint(&set, offsize);
+		addrsize = get_uint(&set, 1);
+		if (get_uint(&set, 1) != 0 || version != 2 ||
+		    (addrsize != 4 && addrsize != 8))
+			return 0;
+		/* Tuples are aligned to twice the address size. */
+		buf_skip(&set, (2 * addrsize - (set.p - o->aranges.p - start) %
+		    (2 * addrsize)) % (2 * addrsize));
+		if ((u = unit_byoff(o, off)) == NULL)
+			return 0;
+		u->covered = 1;
+		for (;;) {
+			lo = get_uint(&set, addrsize);
+			size = get_uint(&set, addrsize);
+			if (set.err)
+				return 0;
+			if (lo == 0 && size == 0)
+				break;
+			if (size != 0)
+				arange_add(o, lo, lo + size, u - o->units);
+		}
+	}
+	a2lstats.dwarfbytes += o->aranges.len;
+	return 1;
+}
+
+/*
+ * Find the units and which addresses each covers.
+ */
+static int
+dbgobj_index(struct dbgobj *o)
+{
+	struct unit *u;
+	struct buf b;
+	size_t size = 0, i;
+	uint64_t len, off;
+	int offsize;
+
+	buf_init(&b, &o->info, 0, o->info.len);
+	while (b.p < b.end) {
+		off = b.p - o->info.p;
+		len = get_length(&b, &offsize);
+		if (b.err || len > (uint64_t)(b.end - b.p))
+			return 0;
+		if (o->nunits == size) {
+			size = size == 0 ? 64 : size * 2;
+			if ((o->units = reallocarray(o->units, size,
+			    sizeof(*o->units))) == NULL)
+				err(1, NULL);
+		}
+		u = &o->units[o->nunits++];
+		memset(u, 0, sizeof(*u));
+		u->off = off;
+		u->end = (b.p - o->info.p) + len;
+		u->offsize = offsize;
+		u->version = get_uint(&b, 2);
+		if (u->version < 2 || u->version > 5)
+			return 0;
+		if (u->version >= 5) {
+			u->type = get_uint(&b, 1);
+			u->addrsize = get_uint(&b, 1);
+			u->abbrevoff = get_uint(&b, offsize);
+			if (u->type == DW_UT_type ||
+			    u->type == DW_UT_split_type)
+				u->state = UNIT_FAILED;		/* no code */
+			else if (u->type != DW_UT_compile &&
+			    u->type != DW_UT_partial)
+				return 0;			/* split DWARF */
+		} else {
+			u->type = DW_UT_compile;
+			u->abbrevoff = get_uint(&b, offsize);
+			u->addrsize = get_uint(&b, 1);
+		}
+		if (b.err || (u->addrsize != 4 && u->addrsize != 8))
+			return 0;
+		u->dieoff = b.p - o->info.p;
+		b.p = o->info.p + u->end;
+	}
+
+	if (o->aranges.len != 0 && !aranges_read(o))
+		return 0;
+	for (i = 0; i < o->nunits; i++)
+		if (o->units[i].state == UNIT_NEW && !unit_root(o, i))
+			return 0;
+	qsort(o->ars, o->nars, sizeof(*o->ars), arangecmp);
+	return 1;
+}
+
+static struct dbgobj *
+dbgobj_get(const char *path)
+{
+	struct dbgobj *o, search;
+
+	search.path = path;
+	if ((o = RB_FIND(dbgobjs, &dbgobjs, &search)) != NULL)
+		return o;
+	if ((o = calloc(1, sizeof(*o))) == NULL ||
+	    (o->path = strdup(path)) == NULL)
+		err(1, NULL);
+	if (!dbgobj_map(o) || !dbgobj_index(o))
+		o->failed = 1;
+	RB_INSERT(dbgobjs, &dbgobjs, o);
+	return o;
+}
+
+/*
+ * Build the full path of a file of the line program.
+ */
+static size_t
+line_file(const struct unit *u, const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+
+	if (name == NULL)
+		return SYM_NONE;
+	if (name[0] == '/' || dir == NULL || dir[0] == '\0') {
+		if (name[0] != '/' && u->compdir != NULL)
+			snprintf(path, sizeof(path), "%s/%s", u->compdir, name);
+		else
+			strlcpy(path, name, sizeof(path));
+	} else if (dir[0] == '/' || u->compdir == NULL)
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+	else
+		snprintf(path, sizeof(path), "%s/%s/%s", u->compdir, dir, name);
+	return sym_intern(path);
+}
+
+static void
+line_addfile(struct unit *u, size_t *size, size_t id)
+{
+	if (u->nfiles == *size) {
+		*size = *size == 0 ? 64 : *size * 2;
+		if ((u->files = reallocarray(u->files, *size,
+		    sizeof(*u->files))) == NULL)
+			err(1, NULL);
+	}
+	u->files[u->nfiles++] = id;
+}
+
+/*
+ * Read the directory or file name table of a DWARF 5 line program
+ * header.  Directories are interned as they are, file names as full
+ * paths.
+ */
+static int
+line_table5(const struct dbgobj *o, struct unit *u, struct buf *b,
+    const char **dirs, size_t ndirs, const char ***dirsp, size_t *ndirsp,
+    size_t *filessize)
+{
+	uint64_t fmt[2 * 16], n, i, j, dir;
+	const char *name;
+	struct attr a;
+	size_t nfmt;
+
+	nfmt = get_uint(b, 1);
+	if (nfmt > nitems(fmt) / 2)
+		return 0;
+	for (i = 0; i < nfmt; i++) {
+		fmt[2 * i] = get_uleb(b);
+		fmt[2 * i + 1] = get_uleb(b);
+	}
+	n = get_uleb(b);
+	if (b->err || n > (uint64_t)(b->end - b->p))
+		return 0;
+	if (dirsp != NULL && (*dirsp = calloc(n, sizeof(**dirsp))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < n; i++) {
+		name = NULL;
+		dir = 0;
+		for (j = 0; j < nfmt; j++) {
+			form_read(u, b, fmt[2 * j + 1], 0, &a);
+			if (fmt[2 * j] == DW_LNCT_path)
+				name = attr_str(o, u, &a);
+			else if (fmt[2 * j] == DW_LNCT_directory_index)
+				dir = a.u;
+		}
+		if (b->err)
+			return 0;
+		if (dirsp != NULL)
+			(*dirsp)[i] = name;
+		else
+			line_addfile(u, filessize, line_file(u,
+			    dir < ndirs ? dirs[dir] : NULL, name));
+	}
+	if (ndirsp != NULL)
+		*ndirsp = n;
+	return 1;
+}
+
+static int
+lseqcmp(const void *a, const void *b)
+{
+	const struct lseq *s1 = a, *s2 = b;
+
+	if (s1->lo != s2->lo)
+		return s1->lo < s2->lo ? -1 : 1;
+	return s1->start < s2->start ? -1 : s1->start > s2->start;
+}
+
+/*
+ * Run the line program of a unit into its table of rows, with the
+ * sequences sorted by address.
+ */
+static int
+line_decode(struct dbgobj *o, struct unit *u)
+{
+	struct lrow *rows = NULL, *row;
+	struct lseq *seqs = NULL;
+	const char **dirs = NULL;
+	struct buf b, prog;
+	uint64_t len, addr, hdrlen;
+	uint8_t oplens[256], op, minlen, linerange, opbase;
+	int8_t linebase;
+	int offsize, version, ok = 0;
+	size_t rowssize = 0, nrows = 0, seqssize = 0, nseqs = 0, start = 0;
+	size_t filessize = 0, ndirs = 0, dirssize = 0, i;
+	uint32_t file, line;
+	const char *name;
+
+	buf_init(&b, &o->line, u->stmtlist, o->line.len -
+	    MIN(u->stmtlist, o->line.len));
+	len = get_length(&b, &offsize);
+	if (b.err || len > (uint64_t)(b.end - b.p))
+		return 0;
+	b.end = b.p + len;
+	a2lstats.dwarfbytes += len;
+	version = get_uint(&b, 2);
+	if (version < 2 || version > 5)
+		return 0;
+	if (version >= 5 && (get_uint(&b, 1) != (uint64_t)u->addrsize ||
+	    get_uint(&b, 1) != 0))
+		return 0;
+	hdrlen = get_uint(&b, offsize);
+	prog = b;
+	buf_skip(&prog, hdrlen);
+	minlen = get_uint(&b, 1);
+	if (version >= 4)
+		(void)get_uint(&b, 1);		/* VLIW only */
+	(void)get_uint(&b, 1);			/* default_is_stmt */
+	linebase = get_uint(&b, 1);
+	linerange = get_uint(&b, 1);
+	opbase = get_uint(&b, 1);
+	if (b.err || linerange == 0 || opbase == 0)
+		return 0;
+	memset(oplens, 0, sizeof(oplens));
+	for (i = 1; i < opbase; i++)
+		oplens[i] = get_uint(&b, 1);
+
+	if (version >= 5) {
+		if (!line_table5(o, u, &b, NULL, 0, &dirs, &ndirs, NULL) ||
+		    !line_table5(o, u, &b, dirs, ndirs, NULL, NULL,
+		    &filessize))
+			goto done;
+	} else {
+		/* Directory 0 is that of the unit, file 0 doesn't exist. */
+		while ((name = get_str(&b)) != NULL && name[0] != '\0') {
+			if (ndirs + 1 >= dirssize) {
+				dirssize = dirssize == 0 ? 16 : dirssize * 2;
+				if ((dirs = reallocarray(dirs, dirssize,
+				    sizeof(*dirs))) == NULL)
+					err(1, NULL);
+			}
+			if (ndirs == 0)
+				dirs[ndirs++] = NULL;
+			dirs[ndirs++] = name;
+		}
+		line_addfile(u, &filessize, SYM_NONE);
+		while ((name = get_str(&b)) != NULL && name[0] != '\0') {
+			i = get_uleb(&b);
+			(void)get_uleb(&b);	/* mtime */
+			(void)get_uleb(&b);	/* length */
+			line_addfile(u, &filessize, line_file(u,
+			    i != 0 && i < ndirs ? dirs[i] : NULL, name));
+		}
+		if (b.err)
+			goto done;
+	}
+
+	addr = 0;
+	file = 1;
+	line = 1;
+	while (prog.p < prog.end && !prog.err) {
+		op = get_uint(&prog, 1);
+		if (op >= opbase) {
+			op -= opbase;
+			addr += (op / linerange) * minlen;
+			line += linebase + op % linerange;
+		} else if (op == 0) {
+			len = get_uleb(&prog);
+			if (prog.err || len == 0 ||
+			    len > (uint64_t)(prog.end - prog.p))
+				goto done;
+			b = prog;
+			b.end = prog.p + len;
+			buf_skip(&prog, len);
+			switch (get_uint(&b, 1)) {
+			case DW_LNE_end_sequence:
+				file = LROW_END;
+				break;
+			case DW_LNE_set_address:
+				addr = get_uint(&b, len - 1 > 8 ? 8 : len - 1);
+				continue;
+			case DW_LNE_define_file:
+				name = get_str(&b);
+				i = get_uleb(&b);
+				if (b.err)
+					goto done;
+				line_addfile(u, &filessize, line_file(u,
+				    i != 0 && i < ndirs ? dirs[i] : NULL,
+				    name));
+				continue;
+			default:
+				continue;
+			}
+		} else {
+			switch (op) {
+			case DW_LNS_copy:
+				break;
+			case DW_LNS_advance_pc:
+				addr += get_uleb(&prog) * minlen;
+				continue;
+			case DW_LNS_advance_line:
+				line += get_sleb(&prog);
+				continue;
+			case DW_LNS_set_file:
+				file = get_uleb(&prog);
+				continue;
+			case DW_LNS_const_add_pc:
+				addr += ((255 - opbase) / linerange) * minlen;
+				continue;
+			case DW_LNS_fixed_advance_pc:
+				addr += get_uint(&prog, 2);
+				continue;
+			default:
+				for (i = 0; i < oplens[op]; i++)
+					(void)get_uleb(&prog);
+				continue;
+			}
+		}
+
+		if (nrows == rowssize) {
+			rowssize = rowssize == 0 ? 1024 : rowssize * 2;
+			if ((rows = reallocarray(rows, rowssize,
+			    sizeof(*rows))) == NULL)
+				err(1, NULL);
+		}
+		row = &rows[nrows++];
+		row->addr = addr;
+		row->file = file;
+		row->line = line;
+		if (file == LROW_END) {
+			if (nseqs == seqssize) {
+				seqssize = seqssize == 0 ? 64 : seqssize * 2;
+				if ((seqs = reallocarray(seqs, seqssize,
+				    sizeof(*seqs))) == NULL)
+					err(1, NULL);
+			}
+			seqs[nseqs].lo = rows[start].addr;
+			seqs[nseqs].start = start;
+			seqs[nseqs].n = nrows - start;
+			nseqs++;
+			start = nrows;
+			addr = 0;
+			file = 1;
+			line = 1;
+		}
+	}
+	if (prog.err)
+		goto done;
+
+	/* Rows of a sequence go up; put the sequences in order. */
+	qsort(seqs, nseqs, sizeof(*seqs), lseqcmp);
+	if (start != 0 && (u->rows = reallocarray(NULL, start,
+	    sizeof(*u->rows))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < nseqs; i++) {
+		memcpy(&u->rows[u->nrows], &rows[seqs[i].start],
+		    seqs[i].n * sizeof(*rows));
+		u->nrows += seqs[i].n;
+	}
+	ok = 1;
+done:
+	free(rows);
+	free(seqs);
+	free(dirs);
+	return ok;
+}
+
+struct funcarg {
+	struct unit *u;
+	struct func f;
+	uint32_t first;		/* of the entries of this DIE */
+};
+
+static void
+func_range(uint64_t lo, uint64_t hi, void *arg)
+{
+	struct funcarg *fa = arg;
+	struct unit *u = fa->u;
+
+	if (u->nfuncs == u->funcssize) {
+		u->funcssize = u->funcssize == 0 ? 256 : u->funcssize * 2;
+		if ((u->funcs = reallocarray(u->funcs, u->funcssize,
+		    sizeof(*u->funcs))) == NULL)
+			err(1, NULL);
+	}
+	if (fa->first == FUNC_NONE)
+		fa->first = u->nfuncs;
+	u->funcs[u->nfuncs] = fa->f;
+	u->funcs[u->nfuncs].lo = lo;
+	u->funcs[u->nfuncs].hi = hi;
+	u->nfuncs++;
+}
+
+/*
+ * The name of a function DIE, or of the DIE it is an instance or the
+ * definition of.
+ */
+static const char *
+die_name(struct dbgobj *o, const struct unit *u, const struct die *d, int hops)
+{
+	struct unit *ru;
+	struct buf b;
+	struct die rd;
+	uint64_t off;
+
+	if (d->has & DIE_NAME)
+		return attr_str(o, u, &d->name);
+	if (hops == DI_MAXHOPS)
+		return NULL;
+	if (d->has & DIE_ORIGIN)
+		off = attr_ref(u, &d->origin);
+	else if (d->has & DIE_SPEC)
+		off = attr_ref(u, &d->spec);
+	else
+		return NULL;
+	if ((ru = unit_byoff(o, off)) == NULL || ru->state == UNIT_NEW ||
+	    ru->state == UNIT_FAILED)
+		return NULL;
+	buf_init(&b, &o->info, off, ru->end - off);
+	if (off < ru->dieoff || die_read(ru, &b, &rd) != 1)
+		return NULL;
+	return die_name(o, ru, &rd, hops + 1);
+}
+
+static int
+frangecmp(const void *a, const void *b)
+{
+	const struct frange *r1 = a, *r2 = b;
+
+	if (r1->lo != r2->lo)
+		return r1->lo < r2->lo ? -1 : 1;
+	return r1->func < r2->func ? -1 : r1->func > r2->func;
+}
+
+/*
+ * Order the function ranges by address, with the highest end so far, so
+ * a lookup can stop at the first range that ends before addr.
+ */
+static void
+func_index(struct unit *u)
+{
+	uint64_t maxhi = 0;
+	size_t i;
+
+	if (u->nfuncs == 0)
+		return;
+	if ((u->franges = reallocarray(NULL, u->nfuncs,
+	    sizeof(*u->franges))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < u->nfuncs; i++) {
+		u->franges[i].lo = u->funcs[i].lo;
+		u->franges[i].func = i;
+	}
+	qsort(u->franges, u->nfuncs, sizeof(*u->franges), frangecmp);
+	for (i = 0; i < u->nfuncs; i++) {
+		maxhi = MAX(maxhi, u->funcs[u->franges[i].func].hi);
+		u->franges[i].maxhi = maxhi;
+	}
+}
+
+/*
+ * Decode the line program and the function ranges of a unit.
+ */
+static int
+unit_decode(struct dbgobj *o, struct unit *u)
+{
+	uint32_t parents[DI_MAXDEPTH];
+	struct funcarg fa;
+	struct buf b;
+	struct die d;
+	int depth = 0, r;
+
+	if (u->hasstmt && !line_decode(o, u))
+		return 0;
+	a2lstats.dwarfbytes += u->end - u->off;
+
+	fa.u = u;
+	parents[0] = FUNC_NONE;
+	buf_init(&b, &o->info, u->dieoff, u->end - u->dieoff);
+	while (b.p < b.end) {
+		if ((r = die_read(u, &b, &d)) == -1)
+			return 0;
+		if (r == 0) {
+			if (--depth <= 0)
+				break;
+			continue;
+		}
+		fa.first = FUNC_NONE;
+		if ((d.tag == DW_TAG_subprogram ||
+		    d.tag == DW_TAG_entry_point ||
+		    d.tag == DW_TAG_inlined_subroutine) &&
+		    (d.has & (DIE_RANGES | DIE_LOWPC)) &&
+		    (fa.f.name = die_name(o, u, &d, 0)) != NULL) {
+			fa.f.parent = depth > 0 ? parents[depth] : FUNC_NONE;
+			fa.f.inlined = d.tag == DW_TAG_inlined_subroutine;
+			fa.f.call_file = (d.has & DIE_CALLFILE) ?
+			    d.callfile.u : 0;
+			fa.f.call_line = (d.has & DIE_CALLLINE) ?
+			    d.callline.u : 0;
+			fa.f.depth = depth;
+			if (!die_ranges(o, u, &d, func_range, &fa))
+				return 0;
+			/* Keep what its children were inlined into. */
+			if (fa.first == FUNC_NONE && d.ab->children)
+				func_range(0, 0, &fa);
+		}
+		if (d.ab->children) {
+			if (++depth == DI_MAXDEPTH)
+				return 0;
+			parents[depth] = fa.first != FUNC_NONE ? fa.first :
+			    parents[depth - 1];
+		} else if (depth == 0)
+			break;
+	}
+	if (b.err)
+		return 0;
+	func_index(u);
+	return 1;
+}
+
+static const struct lrow *
+line_find(const struct unit *u, uint64_t addr)
+{
+	size_t lo = 0, hi = u->nrows, mid;
+
+	/* The last row at or before addr, as addr2line(1) does. */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (u->rows[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || u->rows[lo - 1].file == LROW_END)
+		return NULL;
+	return &u->rows[lo - 1];
+}
+
+static const char *
+unit_file(const struct unit *u, uint64_t i)
+{
+	if (i >= u->nfiles || u->files[i] == SYM_NONE)
+		return NULL;
+	return sym_str(u->files[i], NULL);
+}
+
+/*
+ * Look up addr in the object at path.  Fills in locs with the function
+ * addr is in, with its file and line, followed by the functions it was
+ * inlined into, with the file and line of the call.  Returns how many,
+ * or 0 if libdwarf has to do it.
+ */
+size_t
+debuginfo_lookup(const char *path, uint64_t addr, struct dbgloc *locs,
+    size_t maxlocs)
+{
+	struct dbgobj *o;
+	struct unit *u = NULL;
+	const struct lrow *row;
+	const struct func *f;
+	size_t lo, hi, mid, i, n, best;
+
+	if ((o = dbgobj_get(path)) == NULL || o->failed || maxlocs == 0)
+		return 0;
+
+	/* The last range starting at or before addr, then back. */
+	lo = 0;
+	hi = o->nars;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (o->ars[mid].lo <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	while (lo-- > 0) {
+		if (addr < o->ars[lo].hi) {
+			u = &o->units[o->ars[lo].unit];
+			break;
+		}
+	}
+
+	locs[0].func = NULL;
+	locs[0].file = NULL;
+	locs[0].line = 0;
+	if (u == NULL)
+		return 1;
+	if (u->state == UNIT_ROOT)
+		u->state = unit_decode(o, u) ? UNIT_DECODED : UNIT_FAILED;
+	if (u->state != UNIT_DECODED)
+		return 0;
+
+	if ((row = line_find(u, addr)) != NULL) {
+		locs[0].file = unit_file(u, row->file);
+		locs[0].line = row->line;
+	}
+
+	/* The innermost function around addr. */
+	lo = 0;
+	hi = u->nfuncs;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (u->franges[mid].lo <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	best = FUNC_NONE;
+	while (lo-- > 0 && u->franges[lo].maxhi > addr) {
+		i = u->franges[lo].func;
+		f = &u->funcs[i];
+		if (addr < f->hi && (best == FUNC_NONE ||
+		    f->depth > u->funcs[best].depth ||
+		    (f->depth == u->funcs[best].depth && i > best)))
+			best = i;
+	}
+	if (best == FUNC_NONE)
+		return 1;
+	f = &u->funcs[best];
+	locs[0].func = f->name;
+	for (n = 1; n < maxlocs && f->inlined && f->parent != FUNC_NONE;
+	    n++) {
+		locs[n].func = u->funcs[f->parent].name;
+		locs[n].file = unit_file(u, f->call_file);
+		locs[n].line = f->call_line;
+		f = &u->funcs[f->parent];
+	}
+	return n;
+}
+
+RB_GENERATE_STATIC(dbgobjs, dbgobj, entry, dbgobjcmp)
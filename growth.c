@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Allocation sites whose live bytes keep growing (-g), for programs that
+ * don't exit, or whose caches make the leaks at exit meaningless.
+ *
+ * The replay is cut into windows: seconds of trace time with timestamps,
+ * else thousands of allocations and frees.  The lowest number of bytes a
+ * site had live during a window is what it holds on to through its
+ * churn; at the end of every window that floor is fed to a least squares
+ * fit against time, kept as running means and co-moments, so a site
+ * costs the same few words however long the trace.  A site is growing
+ * when the fit rises, explains most of the variation (r squared), and the floor
+ * went up in many windows and down in few.  A cache filling up looks the
+ * same until it is full; after that its floor stays flat and it drops
+ * out again.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mdump.h"
+
+#define GROWTH_EVENTS	1000	/* events per unit of -g without timestamps */
+#define GROWTH_MINWINS	8	/* before a site is judged */
+#define GROWTH_MINR2	0.8
+#define GROWTH_MINRISE	0.5	/* of the windows, floor went up */
+#define GROWTH_MAXFALL	0.1	/* and went down */
+
+uint64_t growthevents;		/* allocations and frees seen */
+size_t growthwindows;		/* closed */
+
+static uint64_t window;		/* length, in seconds or GROWTH_EVENTS */
+static uint64_t wend;		/* end of the current window, or 0 */
+static int following;		/* -l */
+
+/*
+ * Turn the detector on, with windows of len seconds, or len thousand
+ * events.  While following a trace, growing sites are told right away.
+ */
+void
+growth_init(size_t len, int follow)
+{
+	window = len;
+	following = follow;
+}
+
+int
+growth_active(void)
+{
+	return window != 0;
+}
+
+void
+growth_reset(void)
+{
+	growthevents = 0;
+	growthwindows = 0;
+	wend = 0;
+}
+
+static int
+growth_timed(void)
+{
+	return traceclock.freq != 0 && tracenow != 0;
+}
+
+/* Where the replay is, in ns or events. */
+static uint64_t
+growth_x(void)
+{
+	return growth_timed() ? tracenow : growthevents;
+}
+
+static uint64_t
+growth_unit(void)
+{
+	return growth_timed() ? 1000000000 : GROWTH_EVENTS;
+}
+
+static void
+growth_fit(const struct growth *g, double *slope, double *r2)
+{
+	*slope = g->cxx > 0 ? g->cxy / g->cxx : 0;
+	*r2 = g->cxx > 0 && g->cyy > 0 ?
+	    g->cxy * g->cxy / (g->cxx * g->cyy) : 0;
+}
+
+static int
+growth_judge(const struct growth *g)
+{
+	double slope, r2;
+
+	if (g->nwin < GROWTH_MINWINS)
+		return 0;
+	growth_fit(g, &slope, &r2);
+	return slope > 0 && r2 >= GROWTH_MINR2 &&
+	    g->nrise >= GROWTH_MINRISE * (g->nwin - 1) &&
+	    g->nfall <= GROWTH_MAXFALL * (g->nwin - 1);
+}
+
+static void
+growth_print(FILE *fp, const struct stack *st)
+{
+	const struct growth *g = &st->growth;
+	double slope, r2;
+
+	growth_fit(g, &slope, &r2);
+	fprintf(fp, "%.0f bytes per %s over %u windows, r2 %.2f, rose in "
+	    "%u, fell in %u, %zu bytes live, from:\n", slope,
+	    growth_timed() ? "second" : "1000 events", g->nwin, r2,
+	    g->nrise, g->nfall, st->cur);
+	stack_print(fp, st);
+}
+
+/*
+ * Feed the floors of all sites to their fits at x, in seconds or
+ * thousands of events, and start the next window.
+ */
+static void
+growth_close(double x)
+{
+	struct growth *g;
+	struct stack *st;
+	double dx, dy, y;
+	size_t i;
+
+	growthwindows++;
+	for (i = 0; i < nstacks; i++) {
+		st = stack_byid(i);
+		g = &st->growth;
+		if (g->nwin == 0 && g->low == 0 && st->cur == 0)
+			continue;
+		y = g->low;
+		g->nwin++;
+		dx = x - g->mx;
+		g->mx += dx / g->nwin;
+		dy = y - g->my;
+		g->my += dy / g->nwin;
+		g->cxx += dx * (x - g->mx);
+		g->cxy += dx * (y - g->my);
+		g->cyy += dy * (y - g->my);
+		if (g->nwin > 1) {
+			if (g->low > g->last)
+				g->nrise++;
+			else if (g->low < g->last)
+				g->nfall++;
+		}
+		g->last = g->low;
+		g->low = st->cur;
+
+		/* While following, tell as soon as it shows. */
+		if (following && !g->flagged && growth_judge(g)) {
+			g->flagged = 1;
+			printf("Growing: ");
+			growth_print(stdout, st);
+		}
+	}
+}
+
+/*
+ * Called before every allocation and free is accounted, to close the
+ * window if its end was reached.
+ */
+void
+growth_event(void)
+{
+	uint64_t x;
+
+	if (window == 0)
+		return;
+	growthevents++;
+	x = growth_x();
+	if (wend == 0) {
+		/* After a checkpoint, too: start a window, don't end one. */
+		wend = (x / (window * growth_unit()) + 1) * window *
+		    growth_unit();
+		return;
+	}
+	if (x < wend)
+		return;
+	growth_close((double)x / growth_unit());
+	/* Windows without any events are skipped. */
+	wend = (x / (window * growth_unit()) + 1) * window * growth_unit();
+}
+
+static int
+slopecmp(const void *a, const void *b)
+{
+	const struct stack *s1 = *(struct stack *const *)a;
+	const struct stack *s2 = *(struct stack *const *)b;
+	double l1, l2, r2;
+
+	growth_fit(&s1->growth, &l1, &r2);
+	growth_fit(&s2->growth, &l2, &r2);
+	return l1 < l2 ? 1 : l1 > l2 ? -1 : 0;
+}
+
+/*
+ * Print the ntop growing sites that grow fastest, or all with ntop 0.
+ */
+void
+growth_report(FILE *fp, size_t ntop)
+{
+	struct stack *st, **top;
+	size_t n = 0, i;
+
+	top = xmalloc(nstacks * sizeof(*top) + 1);
+	for (i = 0; i < nstacks; i++) {
+		st = stack_byid(i);
+		if (growth_judge(&st->growth))
+			top[n++] = st;
+	}
+	if (n == 0)
+		fprintf(fp, "No allocation site grew steadily in %zu windows\n",
+		    growthwindows);
+	else
+		fprintf(fp, "%zu allocation sites grew steadily in %zu "
+		    "windows:\n", n, growthwindows);
+	qsort(top, n, sizeof(*top), slopecmp);
+	for (i = 0; i < n && (ntop == 0 || i < ntop); i++)
+		growth_print(fp, top[i]);
+	free(top);
+}
@@ -0,0 +1,560 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Trace input.  Plain trace files are read through stdio.  Compressed
+ * traces (gzip, and zstd when built with HAVE_ZSTD) and plain traces on
+ * pipes are read and decoded by a separate thread into a ring buffer, so
+ * inflating overlaps with replaying.  Ring buffer trace files, written
+ * by the traced program while we read them, are turned back into ktrace
+ * records by the same thread.
+ */
+
+#include <sys/param.h>	/* MIN */
+#include <sys/ktrace.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "mdump.h"
+
+#define INPUT_RINGSIZE	(4 * 1024 * 1024)
+#define INPUT_CHUNK	(256 * 1024)
+#define INPUT_RECMAX	\
+	(sizeof(struct ktr_header) + sizeof(struct ktr_user) + KTR_USER_MAXLEN)
+#define RING_GAPWAIT	1	/* seconds to wait for a missing record */
+
+struct input {
+	FILE *fp;
+	const char *file;
+	int type;
+	int follow;
+	int threaded;
+
+	/* compressed data read from fp, not yet decoded */
+	uint8_t *cbuf;
+	size_t cpos;
+	size_t clen;
+
+	/* decoded data, ring[head % size] is written next */
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	uint8_t *ring;
+	uint64_t head;
+	uint64_t tail;
+	int eof;
+	int stop;
+	char *error;
+
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zds;
+#endif
+
+	/* ring buffer trace file */
+	struct mring_hdr *rhdr;
+	size_t rsize;
+	uint64_t rseq;		/* of the next record to pass on, or -1 */
+	uint32_t rlast;		/* ring that had the last record */
+	time_t rgap;		/* since when rseq is missing, or 0 */
+};
+
+static struct input in;
+
+int
+input_magic(const uint8_t *buf, size_t len)
+{
+	if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b)
+		return INPUT_GZIP;
+	if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f &&
+	    buf[3] == 0xfd)
+		return INPUT_ZSTD;
+	if (len >= sizeof(MRING_MAGIC) - 1 &&
+	    memcmp(buf, MRING_MAGIC, sizeof(MRING_MAGIC) - 1) == 0)
+		return INPUT_RING;
+	return INPUT_RAW;
+}
+
+/*
+ * Find out the type of a trace file, without keeping it open.
+ */
+int
+input_probe(const char *file)
+{
+	uint8_t buf[sizeof(MRING_MAGIC) - 1];
+	size_t len;
+	FILE *fp;
+
+	if (strcmp(file, "-") == 0 || (fp = fopen(file, "r")) == NULL)
+		return INPUT_RAW;
+	len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	return input_magic(buf, len);
+}
+
+static void
+ring_copy(void *dst, const uint8_t *data, uint64_t off, size_t len)
+{
+	size_t size = in.rhdr->ringsize, n;
+
+	off &= size - 1;
+	n = MIN(len, size - off);
+	memcpy(dst, data + off, n);
+	memcpy((uint8_t *)dst + n, data, len - n);
+}
+
+/*
+ * Append the next record, in the order the writers numbered them, to
+ * out as a ktrace record.  Returns its length, 0 if it isn't there (yet)
+ * or -1 if the ring is corrupt.  A record that stays missing, because
+ * its writer died, is skipped after a while.
+ */
+static size_t
+ring_next(uint8_t *out)
+{
+	struct ktr_header hdr;
+	struct mring_rec rec;
+	struct mring *r;
+	uint64_t tail, seq, minseq = UINT64_MAX;
+	uint32_t i, n, ri = 0;
+	size_t reclen;
+
+	for (n = 0; n < in.rhdr->nrings; n++) {
+		i = (in.rlast + n) % in.rhdr->nrings;
+		r = MRING(in.rhdr, i);
+		tail = r->tail;
+		if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+			continue;
+		ring_copy(&seq, MRING_DATA(in.rhdr, i), tail, sizeof(seq));
+		if (seq < minseq) {
+			minseq = seq;
+			ri = i;
+		}
+		if (seq == in.rseq)
+			break;
+	}
+	/* Records read by an earlier mdump are gone. */
+	if (in.rseq == UINT64_MAX)
+		in.rseq = minseq != UINT64_MAX ? minseq :
+		    __atomic_load_n(&in.rhdr->seq, __ATOMIC_ACQUIRE);
+	if (minseq > in.rseq) {
+		/* Nothing numbered yet that we didn't see. */
+		seq = __atomic_load_n(&in.rhdr->seq, __ATOMIC_ACQUIRE);
+		if (minseq == UINT64_MAX && seq <= in.rseq) {
+			in.rgap = 0;
+			return 0;
+		}
+		if (in.rgap == 0)
+			in.rgap = time(NULL);
+		if (time(NULL) - in.rgap <= RING_GAPWAIT)
+			return 0;
+		seq = MIN(seq, minseq);
+		warnx("%s: records %llu-%llu lost", in.file,
+		    (unsigned long long)in.rseq, (unsigned long long)seq - 1);
+		in.rseq = seq;
+		in.rgap = 0;
+		if (minseq == UINT64_MAX)
+			return 0;
+	}
+	in.rgap = 0;
+
+	r = MRING(in.rhdr, ri);
+	tail = r->tail;
+	ring_copy(&rec, MRING_DATA(in.rhdr, ri), tail, sizeof(rec));
+	reclen = roundup(sizeof(rec) + rec.len, 8);
+	if (rec.len > KTR_USER_MAXLEN || reclen > r->head - tail)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ktr_type = KTR_USER;
+	hdr.ktr_pid = rec.pid;
+	hdr.ktr_tid = rec.tid;
+	hdr.ktr_len = sizeof(struct ktr_user) + rec.len;
+	memcpy(out, &hdr, sizeof(hdr));
+	memcpy(out + sizeof(hdr), rec.id, sizeof(rec.id));
+	ring_copy(out + sizeof(hdr) + sizeof(rec.id), MRING_DATA(in.rhdr, ri),
+	    tail + sizeof(rec), rec.len);
+	__atomic_store_n(&r->tail, tail + reclen, __ATOMIC_RELEASE);
+
+	in.rlast = ri;
+	in.rseq++;
+	return sizeof(hdr) + hdr.ktr_len;
+}
+
+/*
+ * Refill cbuf from the rings.  Like input_fill, but the writer might be
+ * about to add a record, so wait briefly even if not following.
+ */
+static int
+ring_fill(void)
+{
+	struct timespec ts = { 0, 10 * 1000 * 1000 };
+	size_t n;
+
+	in.cpos = in.clen = 0;
+	for (;;) {
+		if (in.stop)
+			return 0;
+		while (INPUT_CHUNK - in.clen >= INPUT_RECMAX &&
+		    (n = ring_next(in.cbuf + in.clen)) != 0) {
+			if (n == (size_t)-1) {
+				if (asprintf(&in.error, "%s: corrupt ring",
+				    in.file) == -1)
+					in.error = "corrupt ring";
+				return 0;
+			}
+			in.clen += n;
+		}
+		if (in.clen != 0)
+			return 1;
+		if (!in.follow && in.rgap == 0 && in.rseq != UINT64_MAX &&
+		    __atomic_load_n(&in.rhdr->seq, __ATOMIC_ACQUIRE) <= in.rseq)
+			return 0;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void
+ring_open(void)
+{
+	struct ktr_header start;
+	struct mring_hdr hdr;
+	struct stat sb;
+	int fd;
+
+	if (in.fp == stdin)
+		errx(1, "ring buffers can't be read from a pipe");
+	/* We move the read positions, so the writers can reuse the space. */
+	if ((fd = open(in.file, O_RDWR)) == -1)
+		err(1, "%s", in.file);
+	if (fstat(fd, &sb) == -1)
+		err(1, "%s", in.file);
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		errx(1, "%s: truncated ring header", in.file);
+	if (hdr.nrings == 0 || hdr.nrings > 4096 || hdr.ringsize <
+	    INPUT_RECMAX || (hdr.ringsize & (hdr.ringsize - 1)) != 0)
+		errx(1, "%s: invalid ring header", in.file);
+	in.rsize = MRING_ALIGN * (hdr.nrings + 1) +
+	    (size_t)hdr.nrings * hdr.ringsize;
+	if (sb.st_size < 0 || (size_t)sb.st_size < in.rsize)
+		errx(1, "%s: truncated ring", in.file);
+	if ((in.rhdr = mmap(NULL, in.rsize, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0)) == MAP_FAILED)
+		err(1, "%s", in.file);
+	close(fd);
+
+	in.rseq = UINT64_MAX;
+
+	/* The replay starts with a ktrace header, make one up. */
+	memset(&start, 0, sizeof(start));
+	start.ktr_type = htobe32(KTR_START);
+	start.ktr_pid = hdr.pid;
+	start.ktr_time.tv_sec = hdr.start;
+	memcpy(in.cbuf, &start, sizeof(start));
+	in.cpos = 0;
+	in.clen = sizeof(start);
+}
+
+/*
+ * Refill cbuf from the file.  Returns 0 at end of input; when following
+ * a growing file, waits for more instead.
+ */
+static int
+input_fill(void)
+{
+	size_t n;
+
+	for (;;) {
+		if (in.stop)
+			return 0;
+		if ((n = fread(in.cbuf, 1, INPUT_CHUNK, in.fp)) != 0) {
+			in.cpos = 0;
+			in.clen = n;
+			return 1;
+		}
+		if (ferror(in.fp)) {
+			if (asprintf(&in.error, "%s: read error", in.file) == -1)
+				in.error = "read error";
+			return 0;
+		}
+		if (!in.follow)
+			return 0;
+		(void)sleep(1);
+		clearerr(in.fp);
+	}
+}
+
+/*
+ * Decode from cbuf into out.  Returns the number of bytes produced, 0 if
+ * more input is needed and -1 on a corrupt stream.
+ */
+static ssize_t
+input_decode(uint8_t *out, size_t outlen)
+{
+	size_t n;
+	int ret;
+
+	switch (in.type) {
+	case INPUT_RAW:
+	case INPUT_RING:
+		n = MIN(outlen, in.clen - in.cpos);
+		memcpy(out, in.cbuf + in.cpos, n);
+		in.cpos += n;
+		return n;
+	case INPUT_GZIP:
+		in.zs.next_in = in.cbuf + in.cpos;
+		in.zs.avail_in = in.clen - in.cpos;
+		in.zs.next_out = out;
+		in.zs.avail_out = outlen;
+		ret = inflate(&in.zs, Z_NO_FLUSH);
+		in.cpos = in.clen - in.zs.avail_in;
+		if (ret == Z_STREAM_END) {
+			/* Concatenated members, as written by gzip -c >>. */
+			if (inflateReset(&in.zs) != Z_OK)
+				return -1;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return -1;
+		return outlen - in.zs.avail_out;
+#ifdef HAVE_ZSTD
+	case INPUT_ZSTD: {
+		ZSTD_inBuffer zin = { in.cbuf, in.clen, in.cpos };
+		ZSTD_outBuffer zout = { out, outlen, 0 };
+
+		if (ZSTD_isError(ZSTD_decompressStream(in.zds, &zout, &zin)))
+			return -1;
+		in.cpos = zin.pos;
+		return zout.pos;
+	}
+#endif
+	}
+	return -1;
+}
+
+static void *
+input_thread(void *arg)
+{
+	size_t space;
+	ssize_t n;
+
+	for (;;) {
+		if (in.cpos == in.clen &&
+		    !(in.type == INPUT_RING ? ring_fill() : input_fill()))
+			break;
+
+		pthread_mutex_lock(&in.mtx);
+		while (in.head - in.tail == INPUT_RINGSIZE && !in.stop)
+			pthread_cond_wait(&in.cond, &in.mtx);
+		space = INPUT_RINGSIZE - (in.head - in.tail);
+		space = MIN(space, INPUT_RINGSIZE - in.head % INPUT_RINGSIZE);
+		pthread_mutex_unlock(&in.mtx);
+		if (in.stop)
+			break;
+
+		/* Only this thread moves head, so decode without the lock. */
+		if ((n = input_decode(in.ring + in.head % INPUT_RINGSIZE,
+		    space)) == -1) {
+			if (asprintf(&in.error, "%s: corrupt compressed data",
+			    in.file) == -1)
+				in.error = "corrupt compressed data";
+			break;
+		}
+		if (n == 0)
+			continue;
+		pthread_mutex_lock(&in.mtx);
+		in.head += n;
+		pthread_cond_broadcast(&in.cond);
+		pthread_mutex_unlock(&in.mtx);
+	}
+
+	pthread_mutex_lock(&in.mtx);
+	in.eof = 1;
+	pthread_cond_broadcast(&in.cond);
+	pthread_mutex_unlock(&in.mtx);
+	return arg;
+}
+
+void
+input_close(void)
+{
+	if (in.fp == NULL)
+		return;
+	if (in.threaded) {
+		pthread_mutex_lock(&in.mtx);
+		in.stop = 1;
+		pthread_cond_broadcast(&in.cond);
+		pthread_mutex_unlock(&in.mtx);
+		pthread_join(in.thread, NULL);
+		pthread_mutex_destroy(&in.mtx);
+		pthread_cond_destroy(&in.cond);
+		free(in.ring);
+	}
+	if (in.type == INPUT_GZIP)
+		inflateEnd(&in.zs);
+#ifdef HAVE_ZSTD
+	if (in.type == INPUT_ZSTD)
+		ZSTD_freeDStream(in.zds);
+#endif
+	if (in.rhdr != NULL)
+		munmap(in.rhdr, in.rsize);
+	free(in.cbuf);
+	if (in.fp != stdin)
+		fclose(in.fp);
+	memset(&in, 0, sizeof(in));
+}
+
+void
+input_open(const char *file, int follow)
+{
+	input_close();
+
+	in.file = file;
+	in.follow = follow;
+	if (strcmp(file, "-") == 0)
+		in.fp = stdin;
+	else if ((in.fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	in.cbuf = xmalloc(INPUT_CHUNK);
+
+	/* The magic bytes stay in cbuf, so pipes work as well. */
+	in.clen = fread(in.cbuf, 1, sizeof(MRING_MAGIC) - 1, in.fp);
+	in.type = input_magic(in.cbuf, in.clen);
+
+	switch (in.type) {
+	case INPUT_RAW:
+		if (fseeko(in.fp, 0, SEEK_SET) == 0) {
+			/* Regular file: plain stdio, but in big chunks. */
+			in.clen = 0;
+			if (setvbuf(in.fp, NULL, _IOFBF, INPUT_CHUNK) != 0)
+				err(1, "setvbuf");
+			return;
+		}
+		break;
+	case INPUT_GZIP:
+		/* 15 + 32: maximum window, gzip or zlib header */
+		if (inflateInit2(&in.zs, 15 + 32) != Z_OK)
+			errx(1, "%s: inflateInit2 failed", file);
+		break;
+	case INPUT_ZSTD:
+#ifdef HAVE_ZSTD
+		if ((in.zds = ZSTD_createDStream()) == NULL)
+			errx(1, "%s: ZSTD_createDStream failed", file);
+		break;
+#else
+		errx(1, "%s: zstd compressed, but built without zstd support",
+		    file);
+#endif
+	case INPUT_RING:
+		ring_open();
+		break;
+	}
+
+	in.ring = xmalloc(INPUT_RINGSIZE);
+	if (pthread_mutex_init(&in.mtx, NULL) != 0 ||
+	    pthread_cond_init(&in.cond, NULL) != 0)
+		errx(1, "pthread init failed");
+	if (pthread_create(&in.thread, NULL, input_thread, NULL) != 0)
+		errx(1, "pthread_create failed");
+	in.threaded = 1;
+}
+
+/*
+ * Read exactly len bytes.  Returns 0 at the end of the input; when
+ * following, also when nothing new arrived for a second, without
+ * consuming anything, so the caller can retry.
+ */
+int
+input_read(void *buf, size_t len)
+{
+	struct timespec ts;
+	size_t n;
+
+	if (!in.threaded) {
+		if (fread(buf, len, 1, in.fp) == 1)
+			return 1;
+		if (ferror(in.fp))
+			err(1, "%s", in.file);
+		clearerr(in.fp);
+		return 0;
+	}
+
+	pthread_mutex_lock(&in.mtx);
+	while (in.head - in.tail < len && !in.eof) {
+		if (in.follow) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec++;
+			if (pthread_cond_timedwait(&in.cond, &in.mtx,
+			    &ts) != 0 && in.head - in.tail < len) {
+				pthread_mutex_unlock(&in.mtx);
+				return 0;
+			}
+		} else
+			pthread_cond_wait(&in.cond, &in.mtx);
+	}
+	if (in.error != NULL)
+		errx(1, "%s", in.error);
+	if (in.head - in.tail < len) {
+		pthread_mutex_unlock(&in.mtx);
+		return 0;
+	}
+	n = MIN(len, INPUT_RINGSIZE - in.tail % INPUT_RINGSIZE);
+	memcpy(buf, in.ring + in.tail % INPUT_RINGSIZE, n);
+	memcpy((uint8_t *)buf + n, in.ring, len - n);
+	in.tail += len;
+	pthread_cond_broadcast(&in.cond);
+	pthread_mutex_unlock(&in.mtx);
+	return 1;
+}
+
+/*
+ * Continue reading at offset in the (decompressed) trace.  Compressed
+ * input can only be skipped forward by decoding.
+ */
+void
+input_seek(off_t offset)
+{
+	uint8_t buf[INPUT_CHUNK];
+	uint64_t skip;
+
+	if (!in.threaded) {
+		if (fseeko(in.fp, offset, SEEK_SET) == -1)
+			err(1, "%s", in.file);
+		return;
+	}
+	/* What was read is gone. */
+	if (in.type == INPUT_RING)
+		errx(1, "%s: ring buffers can't be resumed", in.file);
+	if ((uint64_t)offset < in.tail)
+		errx(1, "%s: can't seek backwards", in.file);
+	for (skip = offset - in.tail; skip > 0; skip -= MIN(skip, sizeof(buf)))
+		if (!input_read(buf, MIN(skip, sizeof(buf))))
+			errx(1, "%s: checkpoint beyond end of trace", in.file);
+}
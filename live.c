@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The live set: allocations that have not been freed (yet).
+ *
+ * It is split into partitions by pointer: the address space is cut into
+ * slices of 64k, dealt out to the partitions in turn, so the few ranges
+ * a heap lives in are spread over all of them.  Each partition has a
+ * tree of recent allocations in memory and, once spilled, a sorted array
+ * of older ones in an mmap'd file.  Freeing a spilled allocation marks
+ * its record dead; a file that is mostly dead is merged again, so it
+ * doesn't keep growing with records of allocations long gone.  With a
+ * memory budget set (-b), the partition with the biggest tree is merged
+ * into its file whenever the trees together grow beyond the budget; the
+ * kernel then keeps only the pages of the files that are actually used
+ * in memory.
+ *
+ * With -u, every change is passed on to the page index, see pages.c.
+ *
+ * Walking the live set in pointer order is a merge over all partitions,
+ * so it streams the spill files instead of loading them.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/mman.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdump.h"
+
+#define LIVE_NPART	256
+#define LIVE_SHIFT	16		/* 64k of address space per slice */
+#define LIVE_DEAD	SIZE_MAX	/* stackid of a freed spilled record */
+#define LIVE_COMPACT	2		/* merge once 1/2 of a file is dead */
+
+struct liverec {
+	uintptr_t p;
+	size_t size;
+	size_t stackid;
+	uint64_t time;
+};
+
+RB_HEAD(mallocshead, malloc);
+RB_PROTOTYPE_STATIC(mallocshead, malloc, entry, malloccmp)
+
+struct livepart {
+	struct mallocshead tree;
+	size_t ntree;
+	struct liverec *spill;
+	size_t nspill;
+	size_t ndead;
+};
+
+struct liveiter {
+	struct livepart *part;
+	struct malloc *node;
+	size_t i;
+	struct malloc cur;
+};
+
+static struct livepart parts[LIVE_NPART];
+static size_t livebudget;
+static size_t ntree;
+static size_t nspills;
+
+static int
+malloccmp(const struct malloc *m1, const struct malloc *m2)
+{
+	return m1->p < m2->p ? -1 : m1->p > m2->p;
+}
+
+static struct livepart *
+live_part(uintptr_t p)
+{
+	return &parts[(p >> LIVE_SHIFT) % LIVE_NPART];
+}
+
+static struct liverec *
+live_spillfind(struct livepart *part, uintptr_t p)
+{
+	size_t lo = 0, hi = part->nspill, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (part->spill[mid].p < p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < part->nspill && part->spill[lo].p == p &&
+	    part->spill[lo].stackid != LIVE_DEAD)
+		return &part->spill[lo];
+	return NULL;
+}
+
+static void
+live_fromrec(struct malloc *m, const struct liverec *rec)
+{
+	m->p = rec->p;
+	m->size = rec->size;
+	m->stack = stack_byid(rec->stackid);
+	m->time = rec->time;
+}
+
+/*
+ * Merge the tree of a partition with its spilled records into a new
+ * spill file, dropping dead records on the way.
+ */
+static void
+live_spill(struct livepart *part)
+{
+	struct liverec *spill = NULL, *rec;
+	struct malloc *mptr, *next;
+	char path[PATH_MAX];
+	const char *tmpdir;
+	size_t i, n, len;
+	int fd;
+
+	n = part->ntree + part->nspill - part->ndead;
+	len = n * sizeof(*spill);
+	if (n != 0) {
+		if ((tmpdir = getenv("TMPDIR")) == NULL || *tmpdir == '\0')
+			tmpdir = "/tmp";
+		if ((size_t)snprintf(path, sizeof(path), "%s/mdump.XXXXXXXXXX",
+		    tmpdir) >= sizeof(path))
+			errx(1, "%s: name too long", tmpdir);
+		if ((fd = mkstemp(path)) == -1)
+			err(1, "%s", path);
+		if (unlink(path) == -1)
+			err(1, "unlink %s", path);
+		if (ftruncate(fd, len) == -1)
+			err(1, "%s", path);
+		if ((spill = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0)) == MAP_FAILED)
+			err(1, "mmap");
+		close(fd);
+		/* Children answering queries keep what they saw. */
+		if (minherit(spill, len, MAP_INHERIT_COPY) == -1)
+			err(1, "minherit");
+	}
+
+	rec = spill;
+	i = 0;
+	mptr = RB_MIN(mallocshead, &part->tree);
+	while (mptr != NULL || i < part->nspill) {
+		if (i < part->nspill && part->spill[i].stackid == LIVE_DEAD) {
+			i++;
+			continue;
+		}
+		if (mptr == NULL ||
+		    (i < part->nspill && part->spill[i].p < mptr->p)) {
+			*rec++ = part->spill[i++];
+			continue;
+		}
+		next = RB_NEXT(mallocshead, &part->tree, mptr);
+		RB_REMOVE(mallocshead, &part->tree, mptr);
+		rec->p = mptr->p;
+		rec->size = mptr->size;
+		rec->stackid = mptr->stack->id;
+		rec->time = mptr->time;
+		rec++;
+		free(mptr);
+		mptr = next;
+	}
+
+	if (part->spill != NULL)
+		munmap(part->spill, part->nspill * sizeof(*part->spill));
+	part->spill = spill;
+	part->nspill = n;
+	part->ndead = 0;
+	ntree -= part->ntree;
+	part->ntree = 0;
+	nspills++;
+}
+
+/*
+ * Spill the biggest trees until comfortably below the budget again,
+ * so this doesn't happen on every allocation.
+ */
+static void
+live_shrink(void)
+{
+	struct livepart *part;
+	size_t i;
+
+	while (ntree * sizeof(struct malloc) > livebudget / 2) {
+		part = &parts[0];
+		for (i = 1; i < LIVE_NPART; i++)
+			if (parts[i].ntree > part->ntree)
+				part = &parts[i];
+		live_spill(part);
+	}
+}
+
+void
+live_setbudget(size_t budget)
+{
+	livebudget = budget;
+}
+
+int
+live_find(uintptr_t p, struct malloc *m)
+{
+	struct livepart *part = live_part(p);
+	struct malloc *mptr, msearch;
+	struct liverec *rec;
+
+	msearch.p = p;
+	if ((mptr = RB_FIND(mallocshead, &part->tree, &msearch)) != NULL) {
+		*m = *mptr;
+		return 1;
+	}
+	if ((rec = live_spillfind(part, p)) != NULL) {
+		live_fromrec(m, rec);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Add an allocation.  If its pointer is live already, the existing one
+ * is returned in dup instead.
+ */
+int
+live_insert(const struct malloc *m, struct malloc *dup)
+{
+	struct livepart *part = live_part(m->p);
+	struct malloc *mptr, *old;
+	struct liverec *rec;
+
+	if ((rec = live_spillfind(part, m->p)) != NULL) {
+		live_fromrec(dup, rec);
+		return 0;
+	}
+	mptr = xmalloc(sizeof(*mptr));
+	*mptr = *m;
+	if ((old = RB_INSERT(mallocshead, &part->tree, mptr)) != NULL) {
+		*dup = *old;
+		free(mptr);
+		return 0;
+	}
+	part->ntree++;
+	ntree++;
+	pages_add(m->p, m->size);
+	if (livebudget != 0 && ntree * sizeof(struct malloc) > livebudget)
+		live_shrink();
+	return 1;
+}
+
+int
+live_remove(uintptr_t p, struct malloc *m)
+{
+	struct livepart *part = live_part(p);
+	struct malloc *mptr, msearch;
+	struct liverec *rec;
+
+	msearch.p = p;
+	if ((mptr = RB_FIND(mallocshead, &part->tree, &msearch)) != NULL) {
+		RB_REMOVE(mallocshead, &part->tree, mptr);
+		*m = *mptr;
+		free(mptr);
+		part->ntree--;
+		ntree--;
+		pages_remove(m->p, m->size);
+		return 1;
+	}
+	if ((rec = live_spillfind(part, p)) != NULL) {
+		live_fromrec(m, rec);
+		rec->stackid = LIVE_DEAD;
+		part->ndead++;
+		pages_remove(m->p, m->size);
+		if (part->ndead * LIVE_COMPACT >= part->nspill)
+			live_spill(part);
+		return 1;
+	}
+	return 0;
+}
+
+size_t
+live_count(void)
+{
+	size_t i, n = ntree;
+
+	for (i = 0; i < LIVE_NPART; i++)
+		n += parts[i].nspill - parts[i].ndead;
+	return n;
+}
+
+/*
+ * How many live allocations are in memory and spilled, and how often a
+ * partition was spilled.
+ */
+void
+live_stats(size_t *inmem, size_t *spilled, size_t *spills)
+{
+	*inmem = ntree;
+	*spilled = live_count() - ntree;
+	*spills = nspills;
+}
+
+static int
+liveiter_next(struct liveiter *it)
+{
+	struct livepart *part = it->part;
+
+	while (it->i < part->nspill && part->spill[it->i].stackid == LIVE_DEAD)
+		it->i++;
+	if (it->node == NULL && it->i == part->nspill)
+		return 0;
+	if (it->node == NULL ||
+	    (it->i < part->nspill && part->spill[it->i].p < it->node->p))
+		live_fromrec(&it->cur, &part->spill[it->i++]);
+	else {
+		it->cur = *it->node;
+		it->node = RB_NEXT(mallocshead, &part->tree, it->node);
+	}
+	return 1;
+}
+
+static void
+liveheap_down(struct liveiter **heap, size_t n, size_t i)
+{
+	struct liveiter *tmp;
+	size_t c;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && heap[c + 1]->cur.p < heap[c]->cur.p)
+			c++;
+		if (heap[i]->cur.p <= heap[c]->cur.p)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+	}
+}
+
+/*
+ * Call fn for every live allocation, in order of pointer.
+ */
+void
+live_foreach(void (*fn)(const struct malloc *, void *), void *arg)
+{
+	struct liveiter its[LIVE_NPART], *heap[LIVE_NPART];
+	size_t i, n = 0;
+
+	for (i = 0; i < LIVE_NPART; i++) {
+		its[i].part = &parts[i];
+		its[i].node = RB_MIN(mallocshead, &parts[i].tree);
+		its[i].i = 0;
+		if (liveiter_next(&its[i]))
+			heap[n++] = &its[i];
+	}
+	for (i = n / 2; i-- > 0;)
+		liveheap_down(heap, n, i);
+	while (n > 0) {
+		fn(&heap[0]->cur, arg);
+		if (!liveiter_next(heap[0]))
+			heap[0] = heap[--n];
+		liveheap_down(heap, n, 0);
+	}
+}
+
+void
+live_reset(void)
+{
+	struct malloc *mptr, *next;
+	size_t i;
+
+	for (i = 0; i < LIVE_NPART; i++) {
+		RB_FOREACH_SAFE(mptr, mallocshead, &parts[i].tree, next) {
+			RB_REMOVE(mallocshead, &parts[i].tree, mptr);
+			free(mptr);
+		}
+		if (parts[i].spill != NULL)
+			munmap(parts[i].spill,
+			    parts[i].nspill * sizeof(*parts[i].spill));
+		memset(&parts[i], 0, sizeof(parts[i]));
+	}
+	ntree = 0;
+	pages_reset();
+}
+
+RB_GENERATE_STATIC(mallocshead, malloc, entry, malloccmp);
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The load map of the traced program, from its "malloctrmap" records:
+ * a sorted array of disjoint executable segments, so finding the object
+ * a return address belongs to is a binary search.  A segment announced
+ * later (after a dlopen) replaces the ones it overlaps.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdump.h"
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID	3
+#endif
+
+#define MAXMAPSEGS	(KTR_USER_MAXLEN / sizeof(struct malloc_mapseg))
+
+struct loadseg *loadsegs;
+size_t nloadsegs;
+static size_t loadsegssize;
+
+/*
+ * Add the segment [lo, hi) of the object at base, dropping whatever was
+ * mapped there before.
+ */
+void
+loadmap_insert(uintptr_t lo, uintptr_t hi, uintptr_t base,
+    const uint8_t *id, size_t idlen, const char *path)
+{
+	struct loadseg *seg;
+	size_t i, j, n;
+
+	if (lo >= hi)
+		return;
+	for (i = 0; i < nloadsegs && loadsegs[i].hi <= lo; i++)
+		;
+	for (j = i; j < nloadsegs && loadsegs[j].lo < hi; j++) {
+		free(loadsegs[j].id);
+		free(loadsegs[j].path);
+	}
+	if (i == j && nloadsegs == loadsegssize) {
+		n = loadsegssize == 0 ? 16 : loadsegssize * 2;
+		if ((loadsegs = reallocarray(loadsegs, n,
+		    sizeof(*loadsegs))) == NULL)
+			err(1, NULL);
+		loadsegssize = n;
+	}
+	/* Overwrite the first overlapped one, or make room at i. */
+	memmove(&loadsegs[i + 1], &loadsegs[j],
+	    (nloadsegs - j) * sizeof(*loadsegs));
+	nloadsegs -= j - i;
+	nloadsegs++;
+
+	seg = &loadsegs[i];
+	seg->lo = lo;
+	seg->hi = hi;
+	seg->base = base;
+	seg->id = NULL;
+	seg->idlen = idlen;
+	if (idlen != 0) {
+		seg->id = xmalloc(idlen);
+		memcpy(seg->id, id, idlen);
+	}
+	if ((seg->path = strdup(path)) == NULL)
+		err(1, NULL);
+	seg->checked = 0;
+}
+
+/*
+ * Parse a "malloctrmap" record: one loaded object.
+ */
+void
+loadmap_add(const uint8_t *u, size_t len)
+{
+	struct malloc_mapobj obj;
+	struct malloc_mapseg seg[MAXMAPSEGS];
+	char path[PATH_MAX];
+	const uint8_t *id;
+	size_t i;
+
+	if (len < sizeof(obj))
+		errx(1, "invalid map record");
+	memcpy(&obj, u, sizeof(obj));
+	u += sizeof(obj);
+	len -= sizeof(obj);
+	if (obj.nsegs > nitems(seg) ||
+	    len != obj.nsegs * sizeof(seg[0]) + obj.idlen + obj.namelen)
+		errx(1, "invalid map record");
+	memcpy(seg, u, obj.nsegs * sizeof(seg[0]));
+	u += obj.nsegs * sizeof(seg[0]);
+	id = u;
+	u += obj.idlen;
+	if (obj.namelen >= sizeof(path)) {
+		warnx("Invalid path size");
+		return;
+	}
+	memcpy(path, u, obj.namelen);
+	path[obj.namelen] = '\0';
+
+	for (i = 0; i < obj.nsegs; i++)
+		loadmap_insert(seg[i].lo, seg[i].hi, obj.base, id, obj.idlen,
+		    path);
+}
+
+static const uint8_t *
+buildid_find(const uint8_t *p, size_t len, size_t *idlen)
+{
+	uint32_t namesz, descsz, type;
+	size_t n, d;
+
+	while (len >= 3 * sizeof(uint32_t)) {
+		memcpy(&namesz, p, sizeof(namesz));
+		memcpy(&descsz, p + 4, sizeof(descsz));
+		memcpy(&type, p + 8, sizeof(type));
+		p += 3 * sizeof(uint32_t);
+		len -= 3 * sizeof(uint32_t);
+		n = (namesz + 3) & ~3;
+		d = (descsz + 3) & ~3;
+		if (n > len || d > len - n)
+			break;
+		if (type == NT_GNU_BUILD_ID && namesz == 4 &&
+		    memcmp(p, "GNU", 4) == 0) {
+			*idlen = descsz;
+			return p + n;
+		}
+		p += n + d;
+		len -= n + d;
+	}
+	return NULL;
+}
+
+/*
+ * Warn if the file we are going to read the debug information from is
+ * not the one that was traced.  Files without a build-id can't be
+ * checked.
+ */
+static void
+loadmap_check(struct loadseg *seg, const char *file)
+{
+	static int initialized;
+	const uint8_t *id = NULL;
+	Elf_Scn *scn = NULL;
+	Elf_Data *data;
+	GElf_Shdr sh;
+	size_t idlen = 0, i;
+	Elf *e;
+	int fd;
+
+	/* Other segments of this object need no check. */
+	for (i = 0; i < nloadsegs; i++)
+		if (loadsegs[i].base == seg->base &&
+		    strcmp(loadsegs[i].path, seg->path) == 0)
+			loadsegs[i].checked = 1;
+	if (seg->idlen == 0)
+		return;
+
+	if (!initialized) {
+		if (elf_version(EV_CURRENT) == EV_NONE)
+			errx(1, "elf_version: %s", elf_errmsg(-1));
+		initialized = 1;
+	}
+	if ((fd = open(file, O_RDONLY)) == -1)
+		return;
+	if ((e = elf_begin(fd, ELF_C_READ, NULL)) == NULL) {
+		close(fd);
+		return;
+	}
+	while (id == NULL && (scn = elf_nextscn(e, scn)) != NULL) {
+		if (gelf_getshdr(scn, &sh) == NULL ||
+		    sh.sh_type != SHT_NOTE)
+			continue;
+		if ((data = elf_getdata(scn, NULL)) != NULL)
+			id = buildid_find(data->d_buf, data->d_size,
+			    &idlen);
+	}
+	if (id != NULL &&
+	    (idlen != seg->idlen || memcmp(id, seg->id, idlen) != 0))
+		warnx("%s: build-id differs from the traced object, "
+		    "symbols will be wrong", file);
+	elf_end(e);
+	close(fd);
+}
+
+/*
+ * Find the segment address f is in, or NULL.  The file to read its
+ * symbols from is returned in file.
+ */
+struct loadseg *
+loadmap_find(uintptr_t f, const char **file)
+{
+	size_t lo = 0, hi = nloadsegs, mid;
+	struct loadseg *seg;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		seg = &loadsegs[mid];
+		if (f < seg->lo)
+			hi = mid;
+		else if (f >= seg->hi)
+			lo = mid + 1;
+		else {
+			/* Statically linked, no name. */
+			*file = seg->path[0] == '\0' ? malloc_aout :
+			    seg->path;
+			if (!seg->checked)
+				loadmap_check(seg, *file);
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+void
+loadmap_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < nloadsegs; i++) {
+		free(loadsegs[i].id);
+		free(loadsegs[i].path);
+	}
+	nloadsegs = 0;
+}
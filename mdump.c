@@ -41,6 +41,7 @@
 #include <ctype.h>
 #include <err.h>
 #include <limits.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,18 +51,27 @@
 #include <util.h>
 #include <vis.h>
 
-struct object {
-	uintptr_t f;
-	char fname[PATH_MAX];
-	char *sname;
-	RB_ENTRY(object) entry;
-};
+#include "mdump.h"
+
+#define CHECKPOINT_INTERVAL	60	/* seconds between checkpoints with -l */
+#define ANOMALY_TOP		10	/* stacks of anomalies shown at the end */
+
+/*
+ * Timed records from the batches of different pools are put back in the
+ * order they happened: they wait in a heap until REORDER_WINDOW later
+ * ones have come in, or the end of the trace is reached.
+ */
+#define REORDER_WINDOW	4096
 
-struct malloc {
+struct event {
+	uint64_t time;		/* ns since the trace clock, or 0 */
+	size_t seq;		/* order of arrival, for equal times */
+	uint32_t tid;
+	int type;		/* MALLOC_TRACE_* */
 	uintptr_t p;
+	uintptr_t oldp;
 	size_t size;
-	struct object *obj[200];
-	RB_ENTRY(malloc) entry;
+	struct stack *stack;
 };
 
 enum {
@@ -74,38 +84,72 @@ enum {
 int tail, dump;
 char *tracefile = "ktrace.out";
 char *malloc_aout = "a.out";
-struct ktr_header ktr_header;
+struct ktr_header ktr_header, ktr_start;
 pid_t pid_opt = -1;
-uintptr_t ptrtrace = 0;
+pid_t pid_seen;
+char *ckptfile;
+time_t ckpttime;
+off_t recoff;
+size_t nrecords;
 struct malloc *nmptr;
 int verbose = 0;
 size_t mcur = 0, mmax = 0, mtrigger = 0;
-RB_HEAD(objectshead, object) objects = RB_INITIALIZER(&objects);
-RB_HEAD(mallocshead, malloc) mallocs = RB_INITIALIZER(&mallocs);
+size_t samplerate;
+struct malloc_clock traceclock;
+uint64_t tracenow;
+size_t nstacks, stacktabsize;
+size_t ntracestacks, tracestackssize;
+struct objectshead objects = RB_INITIALIZER(&objects);
+struct stackshead stacks = RB_INITIALIZER(&stacks);
+struct stack **stacktab;
+struct stack **tracestacks;
+struct event *events;
+size_t nevents, eventssize, eventseq;
+uint64_t curtime;
+uint32_t curtid;
 
-static int fread_tail(void *, size_t, size_t);
+static int fread_tail(void *, size_t);
 
 static void ktruser(struct ktr_user *, size_t);
+static void ktrbatch(uint8_t *, size_t);
+static void events_drain(size_t);
+static struct object *object_new(uintptr_t, const char *, uintptr_t);
+static void trace_malloc(struct malloc *);
+static void trace_realloc(struct malloc *, uintptr_t);
+static void trace_free(uintptr_t, struct stack *);
+static void printlifetime(void);
+static const char *stack_top(const struct stack *);
 static void usage(void);
-static void *xmalloc(size_t);
-RB_PROTOTYPE_STATIC(objectshead, object, entry, objectcmp)
-RB_PROTOTYPE_STATIC(mallocshead, malloc, entry, malloccmp)
 
 int
 main(int argc, char *argv[])
 {
-	int ch, silent;
-	size_t ktrlen;
-	int trpoints = KTRFAC_USER;
+	int ch;
 	const char *errstr;
 	long long llresult;
-	char *endptr;
-	uint8_t m[KTR_USER_MAXLEN];
-	struct malloc *mptr;
-	size_t i;
+	char *difffile = NULL, *resumefile = NULL, *sockfile = NULL;
+	const char *promises;
+	char pbuf[64];
+	FILE *profile = NULL;
+	off_t offset = 0;
+	size_t growthwin = 0;
+	int budget = 0, statslevel = 0;
 
-	while ((ch = getopt(argc, argv, "e:f:Dlm:p:P:v")) != -1)
+	while ((ch = getopt(argc, argv, "b:c:d:e:f:Dg:F:lm:o:p:P:r:s:Suv")) != -1)
 		switch (ch) {
+		case 'b':
+			if (scan_scaled(optarg, &llresult) == -1 ||
+			    llresult <= 0 || llresult > SIZE_T_MAX)
+				errx(1, "-b %s: invalid", optarg);
+			live_setbudget(llresult);
+			budget = 1;
+			break;
+		case 'c':
+			ckptfile = optarg;
+			break;
+		case 'd':
+			difffile = optarg;
+			break;
 		case 'e':
 			malloc_aout = optarg;
 			break;
@@ -113,7 +157,15 @@ main(int argc, char *argv[])
 			tracefile = optarg;
 			break;
 		case 'D':
-			dump = 1; 
+			dump = 1;
+			break;
+		case 'g':
+			growthwin = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr)
+				errx(1, "-g %s: %s", optarg, errstr);
+			break;
+		case 'F':
+			report_setformat(optarg);
 			break;
 		case 'l':
 			tail = 1;
@@ -124,15 +176,29 @@ main(int argc, char *argv[])
 				err(1, "Invalid -m");
 			mtrigger = llresult;
 			break;
+		case 'o':
+			if ((profile = fopen(optarg, "w")) == NULL)
+				err(1, "%s", optarg);
+			break;
 		case 'p':
 			pid_opt = strtonum(optarg, 1, INT_MAX, &errstr);
 			if (errstr)
 				errx(1, "-p %s: %s", optarg, errstr);
 			break;
 		case 'P':
-			ptrtrace = strtoull(optarg, &endptr, 16);
-			if (ptrtrace == 0 || endptr[0] != '\0')
-				errx(1, "-P %s: invalid", optarg);
+			watch_add(optarg);
+			break;
+		case 'r':
+			resumefile = optarg;
+			break;
+		case 's':
+			sockfile = optarg;
+			break;
+		case 'S':
+			statslevel++;
+			break;
+		case 'u':
+			pages_init();
 			break;
 		case 'v':
 			verbose++;
@@ -142,34 +208,169 @@ main(int argc, char *argv[])
 		}
 	if (argc > optind)
 		usage();
+	if (growthwin != 0)
+		growth_init(growthwin, tail);
+	stats_init(statslevel);
+	report_init();
+	watch_done();
+	if (difffile != NULL && tail)
+		errx(1, "-d can't be combined with -l");
+	if (sockfile != NULL && !tail)
+		errx(1, "-s needs -l");
 
-	if (pledge("stdio rpath getpw", NULL) == -1)
+	/*
+	 * Checkpoints and spill files need to be created, and we write our
+	 * read position into ring buffers.  Queries are accepted on the
+	 * socket and answered by children.
+	 */
+	if (ckptfile != NULL || budget)
+		promises = "stdio rpath wpath cpath getpw";
+	else if (input_probe(tracefile) == INPUT_RING)
+		promises = "stdio rpath wpath getpw";
+	else
+		promises = "stdio rpath getpw";
+	if (sockfile != NULL) {
+		query_listen(sockfile);
+		(void)snprintf(pbuf, sizeof(pbuf), "%s unix proc", promises);
+		promises = pbuf;
+	}
+	if (pledge(promises, NULL) == -1)
 		err(1, "pledge");
 
-	if (strcmp(tracefile, "-") != 0)
-		if (!freopen(tracefile, "r", stdin))
-			err(1, "%s", tracefile);
+	if (resumefile != NULL)
+		offset = checkpoint_read(resumefile, &ktr_start);
+	replay(tracefile, offset);
+	if (ckptfile != NULL) {
+		stats_phase(PHASE_CHECKPOINT);
+		checkpoint_write(ckptfile, recoff);
+	}
+
+	stats_phase(PHASE_REPORT);
+	if (dump) {
+		state_report(stdout);
+		stats_print(stderr);
+		return(0);
+	}
+	anomaly_report(stderr, ANOMALY_TOP);
+	if (profile != NULL) {
+		profile_write(profile);
+		if (fclose(profile) == EOF)
+			err(1, "profile");
+	}
+	if (difffile != NULL) {
+		profile_diff(difffile);
+		stats_print(stderr);
+		return(0);
+	}
+
+	report_leaks();
+	if (traceclock.freq != 0 && report_format == REPORT_TEXT)
+		printlifetime();
+	if (growth_active() && report_format == REPORT_TEXT)
+		growth_report(stdout, 0);
+	if (pages_active() && report_format == REPORT_TEXT)
+		pages_report(stdout, 0);
+	stats_print(stderr);
+
+	return(0);
+}
+
+/*
+ * How long freed memory lived, overall and for the allocation sites
+ * whose allocations lived longest on average.
+ */
+#define LIFETIME_TOP	10
+
+static int
+lifetimecmp(const void *a, const void *b)
+{
+	const struct stack *s1 = *(struct stack *const *)a;
+	const struct stack *s2 = *(struct stack *const *)b;
+	double l1 = s1->lifetime / s1->nfreed, l2 = s2->lifetime / s2->nfreed;
+
+	return l1 < l2 ? 1 : l1 > l2 ? -1 : 0;
+}
+
+static void
+printlifetime(void)
+{
+	struct stack *st, **top;
+	size_t n = 0, nfreed = 0, i;
+	double lifetime = 0;
+
+	top = xmalloc(nstacks * sizeof(*top) + 1);
+	RB_FOREACH(st, stackshead, &stacks) {
+		if (st->nfreed == 0)
+			continue;
+		nfreed += st->nfreed;
+		lifetime += st->lifetime;
+		top[n++] = st;
+	}
+	if (nfreed != 0) {
+		printf("Mean lifetime of freed memory: %.6fs\n",
+		    lifetime / nfreed);
+		qsort(top, n, sizeof(*top), lifetimecmp);
+		for (i = 0; i < n && i < LIFETIME_TOP; i++) {
+			printf("%.6fs mean over %zu frees of:\n",
+			    top[i]->lifetime / top[i]->nfreed,
+			    top[i]->nfreed);
+			stack_print(stdout, top[i]);
+		}
+	}
+	free(top);
+}
 
-	if (fread_tail(&ktr_header, sizeof(struct ktr_header), 1) == 0 ||
+/*
+ * Feed all records of a trace file through ktruser().  A non-zero offset
+ * continues a replay restored from a checkpoint of the same trace.
+ */
+void
+replay(const char *file, off_t offset)
+{
+	int silent, prev;
+	size_t ktrlen;
+	int trpoints = KTRFAC_USER;
+	uint8_t m[sizeof(struct ktr_user) + KTR_USER_MAXLEN];
+
+	prev = stats_phase(PHASE_REPLAY);
+	input_open(file, tail);
+	if (fread_tail(&ktr_header, sizeof(struct ktr_header)) == 0 ||
 	    ktr_header.ktr_type != htobe32(KTR_START))
-		errx(1, "%s: not a dump", tracefile);
-	while (fread_tail(&ktr_header, sizeof(struct ktr_header), 1)) {
+		errx(1, "%s: not a dump", file);
+	if (offset != 0) {
+		if (memcmp(&ktr_header, &ktr_start, sizeof(ktr_start)) != 0)
+			errx(1, "%s: checkpoint is of a different trace", file);
+		input_seek(offset);
+	} else {
+		ktr_start = ktr_header;
+		pid_seen = 0;
+		offset = sizeof(ktr_header);
+	}
+	recoff = offset;
+	while (fread_tail(&ktr_header, sizeof(struct ktr_header))) {
 		silent = 0;
 		if (pid_opt != -1 && pid_opt != ktr_header.ktr_pid)
 			silent = 1;
 		if (silent == 0) {
-			static pid_t pid;
-			if (pid)  {
-				if (pid != ktr_header.ktr_pid)
+			if (pid_seen)  {
+				if (pid_seen != ktr_header.ktr_pid)
 					errx(1, "-M and multiple pids seen, "
 					    "select one using -p");
 			} else
-				pid = ktr_header.ktr_pid;
+				pid_seen = ktr_header.ktr_pid;
 		}
 
 		ktrlen = ktr_header.ktr_len;
-		if (ktrlen && fread_tail(m, ktrlen, 1) == 0)
+		if (ktrlen > sizeof(m))
+			errx(1, "%s: record too long", file);
+		if (ktrlen && fread_tail(m, ktrlen) == 0)
 			errx(1, "data too short");
+		recoff += sizeof(ktr_header) + ktrlen;
+		nrecords++;
+		stats.records++;
+		stats.bytes += sizeof(ktr_header) + ktrlen;
+		stats_progress();
+		query_check();
 		if (silent)
 			continue;
 		if ((trpoints & (1<<ktr_header.ktr_type)) == 0)
@@ -186,30 +387,64 @@ main(int argc, char *argv[])
 		if (tail)
 			(void)fflush(stdout);
 	}
+	events_drain(0);
+	stats_phase(prev);
+}
 
-	if (!RB_EMPTY(&mallocs) && ptrtrace == 0) {
-		printf("Leaks detected:\n");
-		RB_FOREACH(mptr, mallocshead, &mallocs) {
-			printf("%p: %zu bytes:\n", (void *)mptr->p, mptr->size);
-			for (i = 0; mptr->obj[i] != NULL; i++)
-				printf("%s", mptr->obj[i]->sname);
-		}
+/*
+ * Forget everything learned from a trace, so another one can be replayed.
+ */
+void
+replay_reset(void)
+{
+	struct stack *st, *sttmp;
+	struct object *obj, *otmp;
+
+	live_reset();
+	loadmap_reset();
+	anomaly_reset();
+	RB_FOREACH_SAFE(st, stackshead, &stacks, sttmp) {
+		RB_REMOVE(stackshead, &stacks, st);
+		free(st);
 	}
-	printf("Total memory leaked: %zu\n", mcur);
-	printf("Maximum memory: %zu\n", mmax);
-		
-	return(0);
+	RB_FOREACH_SAFE(obj, objectshead, &objects, otmp) {
+		RB_REMOVE(objectshead, &objects, obj);
+		free(obj);
+	}
+	mcur = mmax = 0;
+	samplerate = 0;
+	memset(&traceclock, 0, sizeof(traceclock));
+	tracenow = 0;
+	growth_reset();
+	nevents = 0;
+	nstacks = 0;
+	ntracestacks = 0;
 }
 
 static int
-fread_tail(void *buf, size_t size, size_t num)
+fread_tail(void *buf, size_t size)
 {
-	int i;
+	int i, prev;
 
-	while ((i = fread(buf, size, num, stdin)) == 0 && tail) {
-		(void)sleep(1);
-		clearerr(stdin);
+	prev = stats_phase(PHASE_READ);
+	while ((i = input_read(buf, size)) == 0 && tail) {
+		stats_phase(PHASE_REPLAY);
+		events_drain(0);
+		/*
+		 * Caught up with the traced process; a good moment to save
+		 * the replay state if it has changed for a while.
+		 */
+		if (ckptfile != NULL && nrecords != 0 &&
+		    time(NULL) - ckpttime >= CHECKPOINT_INTERVAL) {
+			stats_phase(PHASE_CHECKPOINT);
+			checkpoint_write(ckptfile, recoff);
+			ckpttime = time(NULL);
+			nrecords = 0;
+		}
+		stats_phase(PHASE_READ);
+		query_wait(1);
 	}
+	stats_phase(prev);
 	return (i);
 }
 
@@ -224,32 +459,265 @@ objectcmp(const struct object *o1, const struct object *o2)
 }
 
 static int
-malloccmp(const struct malloc *m1, const struct malloc *m2)
+stackcmp(const struct stack *s1, const struct stack *s2)
+{
+	size_t i;
+
+	if (s1->nobj != s2->nobj)
+		return s1->nobj < s2->nobj ? -1 : 1;
+	for (i = 0; i < s1->nobj; i++) {
+		if (s1->obj[i] != s2->obj[i])
+			return s1->obj[i] < s2->obj[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+struct stack *
+stack_intern(struct object **obj, size_t nobj)
+{
+	struct stack *st, search;
+
+	search.obj = obj;
+	search.nobj = nobj;
+	stats.stacklookups++;
+	if ((st = RB_FIND(stackshead, &stacks, &search)) != NULL) {
+		stats.stackhits++;
+		return st;
+	}
+
+	st = xmalloc(sizeof(*st) + nobj * sizeof(*obj));
+	st->obj = (struct object **)(st + 1);
+	memcpy(st->obj, obj, nobj * sizeof(*obj));
+	st->nobj = nobj;
+	st->count = st->cur = st->max = 0;
+	st->wcount = 0;
+	st->nfreed = 0;
+	st->lifetime = 0;
+	memset(&st->growth, 0, sizeof(st->growth));
+	RB_INSERT(stackshead, &stacks, st);
+
+	if (nstacks == stacktabsize) {
+		stacktabsize = stacktabsize == 0 ? 1024 : stacktabsize * 2;
+		if ((stacktab = reallocarray(stacktab, stacktabsize,
+		    sizeof(*stacktab))) == NULL)
+			err(1, NULL);
+	}
+	st->id = nstacks;
+	stacktab[nstacks++] = st;
+	return st;
+}
+
+struct stack *
+stack_byid(size_t id)
+{
+	if (id >= nstacks)
+		errx(1, "invalid stack id %zu", id);
+	return stacktab[id];
+}
+
+/*
+ * Remember the stack malloc announced as id.
+ */
+void
+stack_settrace(size_t id, struct stack *st)
+{
+	size_t n;
+
+	if (id >= tracestackssize) {
+		n = MAX(id + 1, tracestackssize * 2);
+		if ((tracestacks = reallocarray(tracestacks, n,
+		    sizeof(*tracestacks))) == NULL)
+			err(1, NULL);
+		tracestackssize = n;
+	}
+	for (; ntracestacks <= id; ntracestacks++)
+		tracestacks[ntracestacks] = NULL;
+	tracestacks[id] = st;
+}
+
+static struct stack *
+stack_bytrace(size_t id)
+{
+	if (id >= ntracestacks || tracestacks[id] == NULL) {
+		/* Never announced: a damaged or truncated trace. */
+		warnx("unknown stack id %zu", id);
+		stack_settrace(id, stack_intern(NULL, 0));
+	}
+	return tracestacks[id];
+}
+
+/*
+ * Symbolize frame f of an object loaded from path, at offset off.
+ */
+static struct object *
+object_new(uintptr_t f, const char *path, uintptr_t off)
 {
-	return m1->p < m2->p ? -1 : m1->p > m2->p;
+	struct object *obj;
+	int prev;
+
+	obj = xmalloc(sizeof(*obj));
+	obj->f = f;
+	if (strlcpy(obj->fname, path, sizeof(obj->fname)) >=
+	    sizeof(obj->fname)) {
+		warnx("Invalid path size");
+		free(obj);
+		return NULL;
+	}
+	prev = stats_phase(PHASE_SYMBOLIZE);
+	obj->frame = addr2line(obj->fname[0] == '\0' ? malloc_aout :
+	    obj->fname, off);
+	stats_phase(prev);
+	stats.objects++;
+	RB_INSERT(objectshead, &objects, obj);
+	return obj;
 }
 
-void addr2line(const char *object, uintptr_t addr, char **name);
+/*
+ * Resolve the backtrace at the end of a record and intern it.  Frames
+ * seen for the first time are looked up in the load map; frames that
+ * aren't in it are left out.
+ */
+static struct stack *
+stack_parse(uint8_t *u, size_t len)
+{
+	struct object *obj[MAXFRAMES], osearch;
+	struct loadseg *seg;
+	const char *file;
+	size_t i;
+
+	for (i = 0; len >= sizeof(osearch.f) && i < nitems(obj);) {
+		memcpy(&(osearch.f), u, sizeof(osearch.f));
+		stats.frames++;
+		obj[i] = RB_FIND(objectshead, &objects, &osearch);
+		if (obj[i] != NULL)
+			stats.framehits++;
+		else if ((seg = loadmap_find(osearch.f, &file)) != NULL)
+			obj[i] = object_new(osearch.f, file,
+			    osearch.f - seg->base);
+		else
+			stats.unmapped++;
+		if (obj[i] != NULL)
+			i++;
+		u += sizeof(osearch.f);
+		len -= sizeof(osearch.f);
+	}
+	return stack_intern(obj, i);
+}
+
+/*
+ * With sampling, an allocation of size bytes is traced with probability
+ * 1 - exp(-size / samplerate).  Weighing the traced ones by the inverse
+ * of that gives unbiased estimates of the untraced whole.
+ */
+static double
+sample_weight(size_t size)
+{
+	if (samplerate == 0)
+		return 1;
+	return -1 / expm1(-(double)MAX(size, 1) / samplerate);
+}
+
+static size_t
+sample_bytes(size_t size)
+{
+	if (samplerate == 0)
+		return size;
+	return size * sample_weight(size) + 0.5;
+}
+
+static void
+stack_alloc(struct stack *st, size_t size)
+{
+	size_t bytes = sample_bytes(size);
+
+	growth_event();
+	st->wcount += sample_weight(size);
+	st->count = st->wcount + 0.5;
+	st->cur += bytes;
+	if (st->cur > st->max)
+		st->max = st->cur;
+	mcur += bytes;
+	if (mcur > mmax)
+		mmax = mcur;
+	query_thread(curtid, 1, bytes);
+}
+
+static void
+stack_free(struct stack *st, size_t size)
+{
+	size_t bytes = sample_bytes(size);
+
+	growth_event();
+	st->cur -= bytes;
+	if (st->cur < st->growth.low)
+		st->growth.low = st->cur;
+	mcur -= bytes;
+	query_thread(curtid, 0, bytes);
+}
+
+static const char *
+stack_top(const struct stack *st)
+{
+	static char buf[2 * PATH_MAX];
+
+	if (st->nobj == 0)
+		return "??\n";
+	frame_snprint(buf, sizeof(buf), st->obj[0]->frame);
+	return buf;
+}
+
+void
+stack_print(FILE *fp, const struct stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nobj; i++)
+		frame_print(fp, st->obj[i]->frame);
+}
 
 static void
 ktruser(struct ktr_user *usr, size_t len)
 {
 	uint8_t *u = (uint8_t *)(usr + 1);
-	struct object *obj, osearch;
-	struct malloc *mptr, msearch;
-	size_t i;
+	struct object osearch;
+	struct malloc mnew;
 
 	if (len < sizeof(struct ktr_user))
 		errx(1, "invalid ktr user length %zu", len);
 	len -= sizeof(struct ktr_user);
 
-#if 0
-	iwarnxf (dump == 1) {
-		if (strcmp(usr->ktr_id, "mallocdumpline") == 0)
-			printf("%.*s", (int)len, (unsigned char *)(usr + 1));
+	/* With -D, only the state of malloc at exit is looked at. */
+	if (dump) {
+		if (strcmp(usr->ktr_id, "mallocdump") == 0)
+			state_add(u, len);
+		else if (strcmp(usr->ktr_id, "mallocdumpline") == 0)
+			printf("%.*s", (int)len, (char *)u);
+		return;
+	}
+
+	if (strcmp(usr->ktr_id, "mallocbatch") == 0) {
+		ktrbatch(u, len);
+		return;
+	}
+
+	if (strcmp(usr->ktr_id, "mallocsample") == 0) {
+		if (len != sizeof(samplerate))
+			errx(1, "invalid sample record");
+		memcpy(&samplerate, u, sizeof(samplerate));
+		return;
+	}
+
+	if (strcmp(usr->ktr_id, "mallocclock") == 0) {
+		if (len != sizeof(traceclock))
+			errx(1, "invalid clock record");
+		memcpy(&traceclock, u, sizeof(traceclock));
+		return;
+	}
+
+	if (strcmp(usr->ktr_id, "malloctrmap") == 0) {
+		loadmap_add(u, len);
 		return;
 	}
-#endif
 
 	if (strcmp(usr->ktr_id, "malloctrobjecterr") == 0) {
 		uintptr_t offptr;
@@ -266,151 +734,388 @@ ktruser(struct ktr_user *usr, size_t len)
 		return;
 	}
 
+	/* Traces from before "malloctrmap". */
 	if (strcmp(usr->ktr_id, "malloctrobject") == 0) {
 		uintptr_t offptr;
+		char path[PATH_MAX];
 
 		memcpy(&(osearch.f), u, sizeof(osearch.f));
 		u += sizeof(osearch.f);
 		len -= sizeof(osearch.f);
 		if (RB_FIND(objectshead, &objects, &osearch) != NULL)
 			return;
-		obj = xmalloc(sizeof(*obj));
-		obj->f = osearch.f;
 		memcpy(&offptr, u, sizeof(offptr));
 		u += sizeof(offptr);
-		len -= sizeof(obj->f);
-		if (len > sizeof(obj->fname)) {
+		len -= sizeof(offptr);
+		if (len >= sizeof(path)) {
 			warnx("Invalid path size");
 			return;
 		}
-		memcpy(obj->fname, u, len);
-		obj->fname[len] = '\0';
-		addr2line(len == 0 ? malloc_aout : obj->fname, offptr,
-		    &(obj->sname));
-		RB_INSERT(objectshead, &objects, obj);
+		memcpy(path, u, len);
+		path[len] = '\0';
+		(void)object_new(osearch.f, path, offptr);
 		return;
 	}
 
 	if (strcmp(usr->ktr_id, "malloc") == 0) {
-		struct malloc *m;
-
-		mptr = xmalloc(sizeof(*mptr));
-		memcpy(&(mptr->p), u, sizeof(mptr->p));
-		u += sizeof(mptr->p);
-		len -= sizeof(mptr->p);
-		memcpy(&mptr->size, u, sizeof(mptr->size));
-		u += sizeof(mptr->size);
-		len -= sizeof(mptr->size);
-		for (i = 0; len > 0;) {
-			memcpy(&(osearch.f), u, sizeof(osearch.f));
-			mptr->obj[i] = RB_FIND(objectshead, &objects, &osearch);
-			if (mptr->obj[i] != NULL)
-				i++;
-			mptr->obj[i] = NULL;
-			u += sizeof(osearch.f);
-			len -= sizeof(osearch.f);
-		}
+		memcpy(&(mnew.p), u, sizeof(mnew.p));
+		u += sizeof(mnew.p);
+		len -= sizeof(mnew.p);
+		memcpy(&mnew.size, u, sizeof(mnew.size));
+		u += sizeof(mnew.size);
+		len -= sizeof(mnew.size);
+		mnew.stack = stack_parse(u, len);
+		mnew.time = 0;
+		stats.events[MALLOC_TRACE_MALLOC]++;
+		trace_malloc(&mnew);
+		return;
+	}
+	if (strcmp(usr->ktr_id, "realloc") == 0) {
+		uintptr_t oldptr;
 
-		if ((m = RB_INSERT(mallocshead, &mallocs, mptr)) != NULL) {
-			fprintf(stderr, "Duplicate malloc found at (%p):\n",
-			    (void *)m->p);
-			for (i = 0; mptr->obj[i] != NULL; i++)
-				fprintf(stderr, "%s", mptr->obj[i]->sname);
-			fprintf(stderr, "original:\n");
-			for (i = 0; m->obj[i] != NULL; i++)
-				fprintf(stderr, "%s", m->obj[i]->sname);
-			free(mptr);
-			return;
-		}
+		memcpy(&mnew.p, u, sizeof(mnew.p));
+		u += sizeof(mnew.p);
+		len -= sizeof(mnew.p);
+		memcpy(&oldptr, u, sizeof(oldptr));
+		u += sizeof(oldptr);
+		len -= sizeof(oldptr);
+		memcpy(&mnew.size, u, sizeof(mnew.size));
+		u += sizeof(mnew.size);
+		len -= sizeof(mnew.size);
+		mnew.stack = stack_parse(u, len);
+		mnew.time = 0;
+		stats.events[MALLOC_TRACE_REALLOC]++;
+		trace_realloc(&mnew, oldptr);
+		return;
+	}
 
-		if (mptr->p == ptrtrace || verbose)
-			printf("%p = malloc(%zu): %s", (void *)mptr->p, mptr->size,
-			    mptr->obj[0]->sname);
+	if (strcmp(usr->ktr_id, "free") == 0) {
+		uintptr_t p;
 
-		mcur += mptr->size;
-		if (mcur > mmax)
-			mmax = mcur;
+		memcpy(&p, u, sizeof(p));
+		u += sizeof(p);
+		len -= sizeof(p);
+		stats.events[MALLOC_TRACE_FREE]++;
+		trace_free(p, stack_parse(u, len));
 		return;
 	}
-	if (strcmp(usr->ktr_id, "realloc") == 0) {
-		uintptr_t newptr;
-		size_t size;
-		struct malloc *m;
-
-		memcpy(&newptr, u, sizeof(newptr));
-		u += sizeof(newptr);
-		len -= sizeof(newptr);
-		memcpy(&(msearch.p), u, sizeof(msearch.p));
-		u += sizeof(msearch.p);
-		len -= sizeof(msearch.p);
-		memcpy(&(size), u, sizeof(size));
-		u += sizeof(size);
-		len -= sizeof(size);
+}
 
-		memcpy(&(osearch.f), u, sizeof(osearch.f));
-		obj = RB_FIND(objectshead, &objects, &osearch);
-		if (msearch.p != 0) {
-			if ((mptr = RB_FIND(mallocshead, &mallocs,
-			    &msearch)) == NULL) {
-				if (obj == NULL)
-					warnx("realloc ptr %p not found",
-					    (void *)msearch.p);
-				else
-					warnx("realloc ptr %p not found: %s",
-					    (void *)msearch.p, obj->sname);
-				mptr = xmalloc(sizeof(*mptr));
-			} else {
-				RB_REMOVE(mallocshead, &mallocs, mptr);
-				mcur -= mptr->size;
-			}
-		} else
-			mptr = xmalloc(sizeof(*mptr));
-		if (verbose || (ptrtrace != 0 &&
-		    (newptr == ptrtrace || msearch.p == ptrtrace)))
-			printf("%p = realloc(%p, %zu): %s", (void *)newptr,
-			    (void *)msearch.p, size, obj->sname);
-		mcur += size;
-		if (mcur > mmax)
-			mmax = mcur;
-		mptr->size = size;
-		mptr->p = newptr;
-		mptr->obj[0] = obj;
-		mptr->obj[1] = NULL;
-		if ((m = RB_INSERT(mallocshead, &mallocs, mptr)) != NULL) {
-			fprintf(stderr, "Duplicate realloc found at:\n");
-			for (i = 0; mptr->obj[i] != NULL; i++)
-				fprintf(stderr, "%s", mptr->obj[i]->sname);
-			fprintf(stderr, "original:\n");
-			for (i = 0; m->obj[i] != NULL; i++)
-				fprintf(stderr, "%s", m->obj[i]->sname);
-			return;
+/*
+ * Convert a timestamp of the traced program to ns since its clock record.
+ */
+static uint64_t
+clock_ns(uint64_t t)
+{
+	if (traceclock.freq == 0)
+		return 0;
+	/* 0 means untimed. */
+	if (t <= traceclock.time)
+		return 1;
+	return (double)(t - traceclock.time) * 1000000000 / traceclock.freq;
+}
+
+/*
+ * Copy a batch record of len bytes, which is rec and maybe a timestamp,
+ * into rec and ev.  Returns 0 if the length doesn't fit.
+ */
+static int
+batch_get(const uint8_t *u, size_t len, void *rec, size_t reclen,
+    struct event *ev)
+{
+	struct malloc_tracetime tt;
+
+	if (len == reclen) {
+		ev->time = 0;
+		ev->tid = 0;
+	} else if (len == reclen + sizeof(tt)) {
+		memcpy(&tt, u + reclen, sizeof(tt));
+		ev->time = clock_ns(tt.time);
+		ev->tid = tt.tid;
+	} else
+		return 0;
+	memcpy(rec, u, reclen);
+	return 1;
+}
+
+static int
+eventcmp(const struct event *e1, const struct event *e2)
+{
+	if (e1->time != e2->time)
+		return e1->time < e2->time ? -1 : 1;
+	return e1->seq < e2->seq ? -1 : e1->seq > e2->seq;
+}
+
+static void
+event_run(const struct event *ev)
+{
+	struct malloc mnew;
+
+	curtime = ev->time;
+	curtid = ev->tid;
+	if (curtime > tracenow)
+		tracenow = curtime;
+
+	mnew.p = ev->p;
+	mnew.size = ev->size;
+	mnew.stack = ev->stack;
+	mnew.time = ev->time;
+	switch (ev->type) {
+	case MALLOC_TRACE_MALLOC:
+		trace_malloc(&mnew);
+		break;
+	case MALLOC_TRACE_REALLOC:
+		trace_realloc(&mnew, ev->oldp);
+		break;
+	case MALLOC_TRACE_FREE:
+		trace_free(ev->p, ev->stack);
+		break;
+	}
+	curtime = 0;
+	curtid = 0;
+}
+
+/*
+ * Replay the oldest waiting records, until only keep are left.
+ */
+static void
+events_drain(size_t keep)
+{
+	struct event ev, tmp;
+	size_t i, c;
+
+	while (nevents > keep) {
+		ev = events[0];
+		events[0] = events[--nevents];
+		for (i = 0; (c = 2 * i + 1) < nevents; i = c) {
+			if (c + 1 < nevents &&
+			    eventcmp(&events[c + 1], &events[c]) < 0)
+				c++;
+			if (eventcmp(&events[i], &events[c]) <= 0)
+				break;
+			tmp = events[i];
+			events[i] = events[c];
+			events[c] = tmp;
 		}
+		event_run(&ev);
+	}
+}
+
+static void
+event_add(struct event *ev)
+{
+	struct event tmp;
+	size_t i, n;
+
+	/* Untimed records stay in the order they came in. */
+	if (ev->time == 0) {
+		events_drain(0);
+		event_run(ev);
 		return;
 	}
 
-	if (strcmp(usr->ktr_id, "free") == 0) {
-		memcpy(&(msearch.p), u, sizeof(msearch.p));
-		u += sizeof(msearch.p);
-		len -= sizeof(msearch.p);
-		memcpy(&(osearch.f), u, sizeof(osearch.f));
-		obj = RB_FIND(objectshead, &objects, &osearch);
-
-		if ((mptr = RB_FIND(mallocshead, &mallocs, &msearch)) == NULL) {
-			if ((obj) == NULL)
-				warnx("free ptr %p not found", (void *)msearch.p);
-			else
-				warnx("free ptr %p not found: %s", (void *)msearch.p, obj->sname);
-				
-			return;
+	if (nevents == eventssize) {
+		n = eventssize == 0 ? REORDER_WINDOW + 1 : eventssize * 2;
+		if ((events = reallocarray(events, n, sizeof(*events))) ==
+		    NULL)
+			err(1, NULL);
+		eventssize = n;
+	}
+	ev->seq = eventseq++;
+	events[nevents] = *ev;
+	if (++nevents > stats.maxevents)
+		stats.maxevents = nevents;
+	for (i = nevents - 1; i > 0 &&
+	    eventcmp(&events[i], &events[(i - 1) / 2]) < 0; i = (i - 1) / 2) {
+		tmp = events[i];
+		events[i] = events[(i - 1) / 2];
+		events[(i - 1) / 2] = tmp;
+	}
+	events_drain(REORDER_WINDOW);
+}
+
+/*
+ * Unpack a batch record and replay the records in it one by one.
+ */
+static void
+ktrbatch(uint8_t *u, size_t len)
+{
+	struct malloc_batchent ent;
+	struct malloc_trace mt;
+	struct realloc_trace rt;
+	struct free_trace ft;
+	struct event ev;
+	size_t id;
+
+	while (len > 0) {
+		if (len < sizeof(ent))
+			errx(1, "truncated batch record");
+		memcpy(&ent, u, sizeof(ent));
+		u += sizeof(ent);
+		len -= sizeof(ent);
+		if (ent.len > len)
+			errx(1, "truncated batch record");
+
+		if (ent.type < nitems(stats.events))
+			stats.events[ent.type]++;
+		switch (ent.type) {
+		case MALLOC_TRACE_STACK:
+			if (ent.len < sizeof(id))
+				errx(1, "invalid batch record");
+			memcpy(&id, u, sizeof(id));
+			stack_settrace(id, stack_parse(u + sizeof(id),
+			    ent.len - sizeof(id)));
+			break;
+		case MALLOC_TRACE_MALLOC:
+			if (!batch_get(u, ent.len, &mt, sizeof(mt), &ev))
+				errx(1, "invalid batch record");
+			ev.type = ent.type;
+			ev.p = mt.p;
+			ev.oldp = 0;
+			ev.size = mt.sz;
+			ev.stack = stack_bytrace(mt.stack);
+			event_add(&ev);
+			break;
+		case MALLOC_TRACE_REALLOC:
+			if (!batch_get(u, ent.len, &rt, sizeof(rt), &ev))
+				errx(1, "invalid batch record");
+			ev.type = ent.type;
+			ev.p = rt.p;
+			ev.oldp = rt.origp;
+			ev.size = rt.sz;
+			ev.stack = stack_bytrace(rt.stack);
+			event_add(&ev);
+			break;
+		case MALLOC_TRACE_FREE:
+			if (!batch_get(u, ent.len, &ft, sizeof(ft), &ev))
+				errx(1, "invalid batch record");
+			ev.type = ent.type;
+			ev.p = ft.p;
+			ev.oldp = 0;
+			ev.size = 0;
+			ev.stack = stack_bytrace(ft.stack);
+			event_add(&ev);
+			break;
+		default:
+			errx(1, "invalid batch record");
 		}
-		if (verbose || mptr->p == ptrtrace)
-			printf("free(%p): %s", (void *)mptr->p, obj->sname);
-		mcur -= mptr->size;
+		u += ent.len;
+		len -= ent.len;
+	}
+}
 
-		RB_REMOVE(mallocshead, &mallocs, mptr);
-		free(mptr);
+/*
+ * With timestamps, prefix a line with when and in which thread.
+ */
+static void
+event_print(void)
+{
+	if (curtime != 0)
+		printf("%llu.%06llu %u ",
+		    (unsigned long long)(curtime / 1000000000),
+		    (unsigned long long)(curtime % 1000000000 / 1000), curtid);
+}
+
+static void
+trace_malloc(struct malloc *mnew)
+{
+	struct malloc mold;
+
+	if (!live_insert(mnew, &mold)) {
+		anomaly_add(ANOMALY_DUPMALLOC, mold.p, mnew->stack, mold.stack);
+		if (verbose)
+			warnx("duplicate malloc %p: %s", (void *)mold.p,
+			    stack_top(mnew->stack));
+		return;
+	}
+
+	if (watch_hit(mnew->p, mnew->size)) {
+		event_print();
+		printf("%p = malloc(%zu):\n", (void *)mnew->p, mnew->size);
+		stack_print(stdout, mnew->stack);
+	} else if (verbose) {
+		event_print();
+		printf("%p = malloc(%zu): %s", (void *)mnew->p, mnew->size,
+		    stack_top(mnew->stack));
+	}
+
+	stack_alloc(mnew->stack, mnew->size);
+}
+
+static void
+trace_realloc(struct malloc *mnew, uintptr_t oldptr)
+{
+	struct malloc mold;
+	int found = 0;
+
+	/* With sampling: only the old chunk was traced. */
+	if (mnew->p == 0) {
+		trace_free(oldptr, mnew->stack);
 		return;
 	}
+	if (oldptr != 0) {
+		if (!(found = live_remove(oldptr, &mold))) {
+			anomaly_add(ANOMALY_REALLOC, oldptr, mnew->stack,
+			    NULL);
+			if (verbose)
+				warnx("realloc ptr %p not found: %s",
+				    (void *)oldptr, stack_top(mnew->stack));
+		} else
+			stack_free(mold.stack, mold.size);
+	}
+	if (watch_hit(mnew->p, mnew->size) || (oldptr != 0 &&
+	    watch_hit(oldptr, found ? mold.size : 1))) {
+		event_print();
+		printf("%p = realloc(%p, %zu):\n", (void *)mnew->p,
+		    (void *)oldptr, mnew->size);
+		stack_print(stdout, mnew->stack);
+	} else if (verbose) {
+		event_print();
+		printf("%p = realloc(%p, %zu): %s", (void *)mnew->p,
+		    (void *)oldptr, mnew->size, stack_top(mnew->stack));
+	}
+	stack_alloc(mnew->stack, mnew->size);
+	if (!live_insert(mnew, &mold)) {
+		anomaly_add(ANOMALY_DUPREALLOC, mold.p, mnew->stack,
+		    mold.stack);
+		if (verbose)
+			warnx("duplicate realloc %p: %s", (void *)mold.p,
+			    stack_top(mnew->stack));
+	}
+}
+
+static void
+trace_free(uintptr_t p, struct stack *st)
+{
+	struct malloc mold;
+
+	if (!live_remove(p, &mold)) {
+		anomaly_add(ANOMALY_FREE, p, st, NULL);
+		if (verbose && st->nobj == 0)
+			warnx("free ptr %p not found", (void *)p);
+		else if (verbose)
+			warnx("free ptr %p not found: %s", (void *)p,
+			    stack_top(st));
+		if (watch_hit(p, 1)) {
+			event_print();
+			printf("free(%p) (unknown):\n", (void *)p);
+			stack_print(stdout, st);
+		}
+		return;
+	}
+	if (watch_hit(mold.p, mold.size)) {
+		event_print();
+		printf("free(%p) (%zu bytes):\n", (void *)mold.p, mold.size);
+		stack_print(stdout, st);
+	} else if (verbose) {
+		event_print();
+		printf("free(%p): %s", (void *)mold.p, stack_top(st));
+	}
+	stack_free(mold.stack, mold.size);
+	if (mold.time != 0 && curtime > mold.time) {
+		mold.stack->nfreed++;
+		mold.stack->lifetime += (curtime - mold.time) / 1e9;
+	}
 }
 
 static void
@@ -419,12 +1124,14 @@ usage(void)
 
 	extern char *__progname;
 	fprintf(stderr, "usage: %s "
-	    "[-Dl] [-e file] [-f file] [-p pid]\n",
+	    "[-DlSu] [-b size] [-c file] [-d file] [-e file] [-F format]\n"
+	    "\t[-f file] [-g window] [-o file] [-P addr[-addr]] [-p pid]\n"
+	    "\t[-r file] [-s socket]\n",
 	    __progname);
 	exit(1);
 }
 
-static void *
+void *
 xmalloc(size_t sz)
 {
 	void *p = malloc(sz);
@@ -434,5 +1141,5 @@ xmalloc(size_t sz)
 	return p;
 }
 
-RB_GENERATE_STATIC(objectshead, object, entry, objectcmp);
-RB_GENERATE_STATIC(mallocshead, malloc, entry, malloccmp);
+RB_GENERATE(objectshead, object, entry, objectcmp);
+RB_GENERATE(stackshead, stack, entry, stackcmp);
@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define MAXFRAMES	(KTR_USER_MAXLEN / sizeof(uintptr_t))
+
+#define INPUT_RAW	0
+#define INPUT_GZIP	1
+#define INPUT_ZSTD	2
+#define INPUT_RING	3
+
+/*
+ * Ring buffer trace file, written by malloc with MALLOC_TRACEFILE set,
+ * or by the preload library on Linux, instead of utrace(2).  After the
+ * header come nrings struct mring and then the data of the rings, each
+ * ringsize bytes.  A writer owns a ring while it adds a record; records
+ * are numbered from a shared counter, so mdump can put the records of
+ * all rings back in order.  Same layout as in malloc.diff and
+ * preload/mdumptrace.c.
+ */
+#define MRING_MAGIC	"MDUMPRG1"
+#define MRING_ALIGN	64
+#define MRING(h, i)						\
+	((struct mring *)((uint8_t *)(h) + MRING_ALIGN * ((i) + 1)))
+#define MRING_DATA(h, i)						\
+	((uint8_t *)(h) + MRING_ALIGN * ((h)->nrings + 1) +		\
+	    (size_t)(i) * (h)->ringsize)
+
+struct mring_hdr {
+	char magic[8];
+	uint32_t nrings;
+	uint32_t ringsize;	/* a power of 2 */
+	int32_t pid;		/* of the process that created it */
+	uint32_t pad;
+	int64_t start;		/* creation time */
+	volatile uint64_t seq;	/* of the next record */
+};
+
+struct mring {
+	volatile uint64_t head;		/* bytes written */
+	volatile uint64_t tail;		/* bytes read by mdump */
+	volatile uint32_t owner;	/* thread id of the writer, or 0 */
+	uint32_t pad[11];
+};
+
+/* A record, padded to 8 bytes; the payload is that of a utrace(2). */
+struct mring_rec {
+	uint64_t seq;
+	int32_t pid;
+	int32_t tid;
+	uint32_t len;		/* of the payload */
+	char id[KTR_USER_MAXIDLEN];
+};
+
+/*
+ * A "mallocbatch" record packs several records, each preceded by a
+ * struct malloc_batchent.  Stacks are announced once, with an id, and
+ * the malloc, realloc and free records only carry that id.  Same layout
+ * as in malloc.diff.
+ */
+#define MALLOC_TRACE_MALLOC	1
+#define MALLOC_TRACE_REALLOC	2
+#define MALLOC_TRACE_FREE	3
+#define MALLOC_TRACE_STACK	4	/* id, frames */
+
+struct malloc_batchent {
+	uint16_t type;
+	uint16_t len;		/* of the record that follows */
+};
+
+struct malloc_trace {
+	uintptr_t p;
+	size_t sz;
+	size_t stack;
+};
+
+struct realloc_trace {
+	uintptr_t p;		/* 0 if only origp was sampled */
+	uintptr_t origp;	/* 0 if it wasn't */
+	size_t sz;
+	size_t stack;
+};
+
+struct free_trace {
+	uintptr_t p;
+	size_t stack;
+};
+
+/*
+ * With the K malloc option, a malloc, realloc or free record is followed
+ * by the time it happened and the thread that did it.  The time is in
+ * the units of the "mallocclock" record, which also tells the time of
+ * day for one of them.
+ */
+struct malloc_tracetime {
+	uint64_t time;
+	uint32_t tid;
+	uint32_t pad;
+};
+
+struct malloc_clock {
+	uint64_t freq;		/* per second */
+	uint64_t time;
+	int64_t sec;		/* time of day of time */
+	int64_t nsec;
+};
+
+/*
+ * With the D malloc option, every pool sends its state at exit in a
+ * "mallocdump" record: a struct malloc_dumppool, then a struct
+ * malloc_dumpchunk for every size of chunk.  Same layout as in
+ * malloc.diff.
+ */
+struct malloc_dumppool {
+	uint32_t pool;
+	uint32_t nchunks;	/* struct malloc_dumpchunk that follow */
+	uint64_t regions;	/* slots in the region table */
+	uint64_t regionsfree;
+	uint64_t used;		/* bytes allocated */
+	uint64_t guarded;	/* bytes of guard pages */
+	uint64_t big;		/* live regions of whole pages */
+	uint64_t bigpages;
+	uint64_t smallcached;	/* regions in the small cache */
+	uint64_t smallslots;	/* room for them */
+	uint64_t smallpages;
+	uint64_t bigcached;	/* regions in the big cache */
+	uint64_t bigslots;
+	uint64_t bigcachepages;
+	uint64_t delayed;	/* chunks waiting to be freed */
+};
+
+struct malloc_dumpchunk {
+	uint32_t size;		/* of the chunks, 0 for malloc(0) */
+	uint32_t pages;		/* with chunks of this size */
+	uint32_t total;		/* chunks on them */
+	uint32_t free;
+	uint32_t listed;	/* pages on the lists with free chunks */
+	uint32_t spare;		/* unused struct chunk_info */
+};
+
+/*
+ * A "malloctrmap" record announces a loaded object: the struct
+ * malloc_mapobj, its executable segments, build-id and path.  Frames are
+ * sent as plain return addresses and looked up in the segments.
+ */
+struct malloc_mapobj {
+	uintptr_t base;		/* address the object is loaded at */
+	uint16_t nsegs;
+	uint16_t idlen;
+	uint16_t namelen;
+};
+
+struct malloc_mapseg {
+	uintptr_t lo;
+	uintptr_t hi;		/* exclusive */
+};
+
+struct loadseg {
+	uintptr_t lo;
+	uintptr_t hi;
+	uintptr_t base;
+	uint8_t *id;		/* build-id */
+	size_t idlen;
+	char *path;
+	int checked;		/* build-id compared to the file */
+};
+
+struct object {
+	uintptr_t f;
+	char fname[PATH_MAX];
+	size_t frame;		/* symbolized */
+	RB_ENTRY(object) entry;
+};
+
+/*
+ * A symbolized frame: ids of interned strings, and the frame it was
+ * inlined into.
+ */
+#define SYM_NONE	SIZE_MAX
+#define FRAME_NONE	SIZE_MAX
+
+struct frame {
+	size_t func;
+	size_t file;
+	unsigned long line;
+	size_t caller;		/* or FRAME_NONE */
+};
+
+/*
+ * How the live bytes of a site developed over the windows of -g, see
+ * growth.c: the fit of its floors against time, as means and co-moments.
+ */
+struct growth {
+	double mx, my;
+	double cxx, cxy, cyy;
+	size_t low;		/* lowest cur in the current window */
+	size_t last;		/* low of the window before */
+	uint32_t nwin;		/* windows fitted */
+	uint32_t nrise;		/* that ended with a higher floor */
+	uint32_t nfall;
+	int flagged;		/* told while following */
+};
+
+/*
+ * An allocation site: the resolved frames of a backtrace, together with
+ * the per-site accounting done during replay.
+ */
+struct stack {
+	size_t id;		/* index in order of appearance */
+	struct object **obj;
+	size_t nobj;
+	size_t count;		/* allocations made from this site */
+	double wcount;		/* count, weighed for sampling */
+	size_t cur;		/* bytes currently live */
+	size_t max;		/* high-water mark of cur */
+	size_t nfreed;		/* timed frees */
+	double lifetime;	/* of those, summed up, in seconds */
+	struct growth growth;
+	RB_ENTRY(stack) entry;
+};
+
+struct malloc {
+	uintptr_t p;
+	size_t size;
+	struct stack *stack;
+	uint64_t time;		/* ns since the trace clock, or 0 */
+	RB_ENTRY(malloc) entry;
+};
+
+RB_HEAD(objectshead, object);
+RB_HEAD(stackshead, stack);
+RB_PROTOTYPE(objectshead, object, entry, objectcmp)
+RB_PROTOTYPE(stackshead, stack, entry, stackcmp)
+
+extern struct objectshead objects;
+extern struct stackshead stacks;
+extern size_t mcur, mmax;
+extern size_t samplerate;	/* mean bytes between samples, or 0 */
+extern struct malloc_clock traceclock;	/* freq 0 without timestamps */
+extern uint64_t tracenow;	/* ns, of the latest timed record */
+extern size_t nstacks;
+extern struct stack **tracestacks;	/* by id announced in the trace */
+extern size_t ntracestacks;
+extern struct ktr_header ktr_start;
+extern char *malloc_aout;
+extern struct loadseg *loadsegs;	/* sorted */
+extern size_t nloadsegs;
+extern pid_t pid_seen;
+
+/* addr2line.c */
+struct addr2line_stats {
+	size_t calls;
+	size_t opened;		/* objects */
+	size_t fallbacks;	/* lookups done with libdwarf */
+	uint64_t dwarfbytes;	/* of debug sections read */
+};
+extern struct addr2line_stats a2lstats;
+
+size_t addr2line(const char *, uintptr_t);
+
+/* anomaly.c */
+enum {
+	ANOMALY_DUPMALLOC,
+	ANOMALY_DUPREALLOC,
+	ANOMALY_REALLOC,	/* of a pointer not live */
+	ANOMALY_FREE,
+	ANOMALY_MAX
+};
+
+#define ANOMALY_EXAMPLES	4
+
+struct anomaly {
+	int kind;			/* ANOMALY_* */
+	struct stack *stack;
+	struct stack *orig;		/* of the first duplicate, or NULL */
+	size_t count;
+	uintptr_t examples[ANOMALY_EXAMPLES];
+	RB_ENTRY(anomaly) entry;
+};
+
+void anomaly_add(int, uintptr_t, struct stack *, struct stack *);
+void anomaly_reset(void);
+size_t anomaly_count(void);
+void anomaly_foreach(void (*)(const struct anomaly *, void *), void *);
+void anomaly_restore(const struct anomaly *);
+size_t anomaly_report(FILE *, size_t);
+
+/* checkpoint.c */
+void checkpoint_write(const char *, off_t);
+off_t checkpoint_read(const char *, struct ktr_header *);
+
+/* debuginfo.c */
+#define DBGLOC_MAX	32
+
+struct dbgloc {
+	const char *func;	/* or NULL */
+	const char *file;	/* or NULL */
+	unsigned long line;
+};
+
+size_t debuginfo_lookup(const char *, uint64_t, struct dbgloc *, size_t);
+
+/* growth.c */
+extern uint64_t growthevents;
+extern size_t growthwindows;
+
+void growth_init(size_t, int);
+int growth_active(void);
+void growth_reset(void);
+void growth_event(void);
+void growth_report(FILE *, size_t);
+
+/* input.c */
+int input_magic(const uint8_t *, size_t);
+int input_probe(const char *);
+void input_open(const char *, int);
+void input_close(void);
+int input_read(void *, size_t);
+void input_seek(off_t);
+
+/* loadmap.c */
+void loadmap_add(const uint8_t *, size_t);
+void loadmap_insert(uintptr_t, uintptr_t, uintptr_t, const uint8_t *, size_t,
+    const char *);
+struct loadseg *loadmap_find(uintptr_t, const char **);
+void loadmap_reset(void);
+
+/* live.c */
+void live_setbudget(size_t);
+int live_find(uintptr_t, struct malloc *);
+int live_insert(const struct malloc *, struct malloc *);
+int live_remove(uintptr_t, struct malloc *);
+size_t live_count(void);
+void live_stats(size_t *, size_t *, size_t *);
+void live_foreach(void (*)(const struct malloc *, void *), void *);
+void live_reset(void);
+
+/* pages.c */
+extern size_t pagespeak;
+extern size_t pagespeakbytes;
+
+void pages_init(void);
+int pages_active(void);
+void pages_add(uintptr_t, size_t);
+void pages_remove(uintptr_t, size_t);
+void pages_reset(void);
+void pages_report(FILE *, size_t);
+
+/* query.c */
+struct qthread {
+	uint32_t tid;
+	size_t nalloc;
+	size_t nfree;
+	size_t allocated;	/* bytes */
+	size_t freed;
+	RB_ENTRY(qthread) entry;
+};
+
+extern uint64_t peaktime;
+
+void query_listen(const char *);
+void query_thread(uint32_t, int, size_t);
+size_t query_nthreads(void);
+void query_foreachthread(void (*)(const struct qthread *, void *), void *);
+void query_restorethread(const struct qthread *);
+void query_check(void);
+void query_wait(int);
+
+/* report.c */
+#define REPORT_TEXT	0
+#define REPORT_JSON	1
+#define REPORT_CSV	2
+
+extern int report_format;
+
+void report_setformat(const char *);
+void report_init(void);
+void report_leaks(void);
+
+/* state.c */
+void state_add(const uint8_t *, size_t);
+void state_report(FILE *);
+
+/* stats.c */
+enum {
+	PHASE_STARTUP,
+	PHASE_READ,		/* waiting for the trace */
+	PHASE_REPLAY,
+	PHASE_SYMBOLIZE,
+	PHASE_CHECKPOINT,
+	PHASE_REPORT,
+	PHASE_MAX
+};
+
+struct mdump_stats {
+	size_t records;
+	size_t bytes;
+	size_t events[MALLOC_TRACE_STACK + 1];	/* by MALLOC_TRACE_* */
+	size_t maxevents;	/* waiting to be reordered */
+	size_t stacklookups;
+	size_t stackhits;	/* interned before */
+	size_t frames;
+	size_t framehits;	/* symbolized before */
+	size_t unmapped;	/* frames not in the load map */
+	size_t objects;		/* frames symbolized */
+};
+extern struct mdump_stats stats;
+
+void stats_init(int);
+int stats_phase(int);
+void stats_progress(void);
+void stats_print(FILE *);
+
+/* symbol.c */
+extern size_t nsyms, nframes;
+
+size_t sym_intern(const char *);
+const char *sym_str(size_t, size_t *);
+size_t sym_alias(size_t);
+void sym_setalias(size_t, size_t);
+size_t frame_intern(const struct frame *);
+const struct frame *frame_get(size_t);
+void frame_snprint(char *, size_t, size_t);
+void frame_print(FILE *, size_t);
+
+/* watch.c */
+void watch_add(const char *);
+void watch_done(void);
+int watch_active(void);
+int watch_hit(uintptr_t, size_t);
+
+/* mdump.c */
+void replay(const char *, off_t);
+void replay_reset(void);
+struct stack *stack_intern(struct object **, size_t);
+struct stack *stack_byid(size_t);
+void stack_settrace(size_t, struct stack *);
+void stack_print(FILE *, const struct stack *);
+void *xmalloc(size_t);
+
+/* profile.c */
+void profile_write(FILE *);
+void profile_diff(const char *);
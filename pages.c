@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The pages the live set keeps in use (-u): a page holding a single live
+ * byte can't be given back, so a heap of half empty pages costs far more
+ * than its live bytes.
+ *
+ * Only pages partly covered by an allocation are kept in a tree, with
+ * the live bytes and allocations on them; the pages in between the first
+ * and last page of a bigger allocation are full and only counted.  The
+ * live set calls pages_add() and pages_remove() for every change, so the
+ * totals are current at any point of the replay and the peak is known.
+ * Which allocation sites hold on to mostly empty pages is worked out
+ * when asked, from the live set.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+#define PAGES_SHIFT	12	/* the page size of the traced program */
+#define PAGES_SIZE	((size_t)1 << PAGES_SHIFT)
+#define PAGES_SPARSE	4	/* below a quarter used, a page is sparse */
+#define PAGES_BUCKETS	4
+
+struct page {
+	uintptr_t pageno;
+	uint32_t used;		/* live bytes */
+	uint32_t nblocks;	/* live allocations touching it */
+	RB_ENTRY(page) entry;
+};
+
+RB_HEAD(pageshead, page);
+RB_PROTOTYPE_STATIC(pageshead, page, entry, pagecmp)
+
+size_t pagespeak;		/* peak of npages + nfull */
+size_t pagespeakbytes;		/* live bytes at that peak */
+
+static struct pageshead pages = RB_INITIALIZER(&pages);
+static int pageson;
+static size_t npages;		/* in the tree */
+static size_t nfull;		/* not in the tree */
+static size_t pagebytes;	/* live bytes on the pages in the tree */
+
+static int
+pagecmp(const struct page *p1, const struct page *p2)
+{
+	return p1->pageno < p2->pageno ? -1 : p1->pageno > p2->pageno;
+}
+
+void
+pages_init(void)
+{
+	pageson = 1;
+}
+
+int
+pages_active(void)
+{
+	return pageson;
+}
+
+static struct page *
+pages_get(uintptr_t pageno)
+{
+	struct page *pg, search;
+
+	search.pageno = pageno;
+	if ((pg = RB_FIND(pageshead, &pages, &search)) != NULL)
+		return pg;
+	pg = xmalloc(sizeof(*pg));
+	pg->pageno = pageno;
+	pg->used = 0;
+	pg->nblocks = 0;
+	RB_INSERT(pageshead, &pages, pg);
+	npages++;
+	return pg;
+}
+
+static void
+pages_put(struct page *pg)
+{
+	if (pg->nblocks != 0)
+		return;
+	RB_REMOVE(pageshead, &pages, pg);
+	free(pg);
+	npages--;
+}
+
+static void
+pages_change(uintptr_t pageno, size_t bytes, int add)
+{
+	struct page *pg, search;
+
+	if (add) {
+		pg = pages_get(pageno);
+		pg->used += bytes;
+		pg->nblocks++;
+		pagebytes += bytes;
+		return;
+	}
+	search.pageno = pageno;
+	if ((pg = RB_FIND(pageshead, &pages, &search)) == NULL)
+		errx(1, "page %#lx not in use", (unsigned long)pageno);
+	pg->used -= bytes;
+	pg->nblocks--;
+	pagebytes -= bytes;
+	pages_put(pg);
+}
+
+/*
+ * Put the size bytes at p on, or take them off, their pages.
+ */
+static void
+pages_block(uintptr_t p, size_t size, int add)
+{
+	uintptr_t first = p >> PAGES_SHIFT, last, inner;
+
+	if (size == 0 || p + size - 1 < p) {
+		pages_change(first, 0, add);
+		return;
+	}
+	last = (p + size - 1) >> PAGES_SHIFT;
+	if (first == last) {
+		pages_change(first, size, add);
+		return;
+	}
+	pages_change(first, ((first + 1) << PAGES_SHIFT) - p, add);
+	pages_change(last, p + size - (last << PAGES_SHIFT), add);
+	inner = last - first - 1;
+	if (add)
+		nfull += inner;
+	else
+		nfull -= inner;
+}
+
+void
+pages_add(uintptr_t p, size_t size)
+{
+	if (!pageson)
+		return;
+	pages_block(p, size, 1);
+	if (npages + nfull > pagespeak) {
+		pagespeak = npages + nfull;
+		pagespeakbytes = pagebytes + nfull * PAGES_SIZE;
+	}
+}
+
+void
+pages_remove(uintptr_t p, size_t size)
+{
+	if (pageson)
+		pages_block(p, size, 0);
+}
+
+void
+pages_reset(void)
+{
+	struct page *pg, *next;
+
+	RB_FOREACH_SAFE(pg, pageshead, &pages, next) {
+		RB_REMOVE(pageshead, &pages, pg);
+		free(pg);
+	}
+	npages = nfull = pagebytes = 0;
+	pagespeak = pagespeakbytes = 0;
+}
+
+static int
+pages_sparse(const struct page *pg)
+{
+	return pg->used * PAGES_SPARSE < PAGES_SIZE;
+}
+
+/*
+ * Sites holding on to sparse pages: the share of each page they have
+ * allocations on, split evenly between the allocations on it.
+ */
+struct pagesite {
+	struct stack *stack;
+	double pages;
+	size_t bytes;
+	size_t nblocks;
+};
+
+static int
+pages_charge(struct pagesite *ps, uintptr_t pageno, size_t bytes)
+{
+	struct page *pg, search;
+
+	search.pageno = pageno;
+	if ((pg = RB_FIND(pageshead, &pages, &search)) == NULL ||
+	    !pages_sparse(pg))
+		return 0;
+	ps->pages += 1.0 / pg->nblocks;
+	ps->bytes += bytes;
+	return 1;
+}
+
+static void
+pages_site(const struct malloc *mptr, void *arg)
+{
+	struct pagesite *ps = (struct pagesite *)arg + mptr->stack->id;
+	uintptr_t p = mptr->p, first = p >> PAGES_SHIFT, last;
+	int charged;
+
+	if (mptr->size == 0 || p + mptr->size - 1 < p)
+		charged = pages_charge(ps, first, 0);
+	else if ((last = (p + mptr->size - 1) >> PAGES_SHIFT) == first)
+		charged = pages_charge(ps, first, mptr->size);
+	else {
+		charged = pages_charge(ps, first,
+		    ((first + 1) << PAGES_SHIFT) - p);
+		charged |= pages_charge(ps, last,
+		    p + mptr->size - (last << PAGES_SHIFT));
+	}
+	if (charged) {
+		ps->stack = mptr->stack;
+		ps->nblocks++;
+	}
+}
+
+static int
+sitecmp(const void *a, const void *b)
+{
+	const struct pagesite *s1 = a, *s2 = b;
+
+	return s1->pages < s2->pages ? 1 : s1->pages > s2->pages ? -1 : 0;
+}
+
+static double
+occupancy(size_t bytes, size_t npg)
+{
+	return npg == 0 ? 0 : 100.0 * bytes / (npg * PAGES_SIZE);
+}
+
+/*
+ * Print the pages in use, how full they are, and the ntop sites holding
+ * on to the most sparse pages, or all of them with ntop 0.
+ */
+void
+pages_report(FILE *fp, size_t ntop)
+{
+	struct pagesite *sites;
+	struct page *pg;
+	size_t bucket[PAGES_BUCKETS], nsparse = 0, n, i;
+
+	fprintf(fp, "%zu pages of %zu bytes in use, %.1f%% occupied; peak "
+	    "%zu pages, %.1f%% occupied\n", npages + nfull, PAGES_SIZE,
+	    occupancy(pagebytes + nfull * PAGES_SIZE, npages + nfull),
+	    pagespeak, occupancy(pagespeakbytes, pagespeak));
+	if (samplerate != 0)
+		fprintf(fp, "Sampled: only the pages of the traced "
+		    "allocations are known\n");
+
+	memset(bucket, 0, sizeof(bucket));
+	RB_FOREACH(pg, pageshead, &pages) {
+		bucket[MIN(pg->used * PAGES_BUCKETS / PAGES_SIZE,
+		    PAGES_BUCKETS - 1)]++;
+		if (pages_sparse(pg))
+			nsparse++;
+	}
+	bucket[PAGES_BUCKETS - 1] += nfull;
+	for (i = 0; i < PAGES_BUCKETS; i++)
+		fprintf(fp, "%3zu%%-%3zu%% used: %zu pages\n",
+		    100 * i / PAGES_BUCKETS, 100 * (i + 1) / PAGES_BUCKETS,
+		    bucket[i]);
+	if (nsparse == 0)
+		return;
+
+	if ((sites = calloc(nstacks + 1, sizeof(*sites))) == NULL)
+		err(1, NULL);
+	live_foreach(pages_site, sites);
+	for (i = n = 0; i < nstacks; i++)
+		if (sites[i].stack != NULL)
+			sites[n++] = sites[i];
+	qsort(sites, n, sizeof(*sites), sitecmp);
+	fprintf(fp, "%zu pages less than %d%% used, held by:\n", nsparse,
+	    100 / PAGES_SPARSE);
+	for (i = 0; i < n && (ntop == 0 || i < ntop); i++) {
+		fprintf(fp, "%.1f pages with %zu bytes in %zu allocations, "
+		    "from:\n", sites[i].pages, sites[i].bytes,
+		    sites[i].nblocks);
+		stack_print(fp, sites[i].stack);
+	}
+	free(sites);
+}
+
+RB_GENERATE_STATIC(pageshead, page, entry, pagecmp)
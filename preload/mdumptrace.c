@@ -0,0 +1,834 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Malloc tracing for Linux, to be loaded with LD_PRELOAD.  It writes the
+ * same records as malloc.diff does, into the ring buffer trace file
+ * named by MALLOC_TRACEFILE, for mdump to read while the program runs:
+ *
+ *	$ MALLOC_TRACEFILE=trace.ring LD_PRELOAD=./libmdumptrace.so program
+ *	$ mdump -l -f trace.ring
+ *
+ * Every allocation and free is traced, there are no per pool batches;
+ * writing a record into the ring is cheap enough.  When all rings are
+ * full, the program waits for mdump to catch up.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KTR_USER_MAXIDLEN	20
+#define KTR_USER_MAXLEN		2048
+
+/* Same layout as in mdump.h. */
+#define MRING_MAGIC	"MDUMPRG1"
+#define MRING_ALIGN	64
+#define MRING(h, i)						\
+	((struct mring *)((uint8_t *)(h) + MRING_ALIGN * ((i) + 1)))
+#define MRING_DATA(h, i)						\
+	((uint8_t *)(h) + MRING_ALIGN * ((h)->nrings + 1) +		\
+	    (size_t)(i) * (h)->ringsize)
+
+struct mring_hdr {
+	char magic[8];
+	uint32_t nrings;
+	uint32_t ringsize;
+	int32_t pid;
+	uint32_t pad;
+	int64_t start;
+	volatile uint64_t seq;
+};
+
+struct mring {
+	volatile uint64_t head;
+	volatile uint64_t tail;
+	volatile uint32_t owner;
+	uint32_t pad[11];
+};
+
+struct mring_rec {
+	uint64_t seq;
+	int32_t pid;
+	int32_t tid;
+	uint32_t len;
+	char id[KTR_USER_MAXIDLEN];
+};
+
+#define MALLOC_TRACE_MALLOC	1
+#define MALLOC_TRACE_REALLOC	2
+#define MALLOC_TRACE_FREE	3
+#define MALLOC_TRACE_STACK	4
+
+struct malloc_batchent {
+	uint16_t type;
+	uint16_t len;
+};
+
+struct malloc_trace {
+	uintptr_t p;
+	size_t sz;
+	size_t stack;
+};
+
+struct realloc_trace {
+	uintptr_t p;
+	uintptr_t origp;
+	size_t sz;
+	size_t stack;
+};
+
+struct free_trace {
+	uintptr_t p;
+	size_t stack;
+};
+
+struct malloc_mapobj {
+	uintptr_t base;
+	uint16_t nsegs;
+	uint16_t idlen;
+	uint16_t namelen;
+};
+
+#define TRACE_NRINGS	64
+#define TRACE_RINGSIZE	(1024 * 1024)
+#define TRACE_MAXFRAMES	64
+#define TRACE_SKIP	2	/* trace_backtrace() and the wrapper */
+#define TRACE_STACKS	(64 * 1024)	/* slots in the stack table */
+#define TRACE_BOOTSTRAP	(64 * 1024)
+#define TRACE_NT_GNU_BUILD_ID	3
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define TLS	__thread __attribute__((tls_model("initial-exec")))
+
+struct tracewr {
+	struct mring *r;
+	uint8_t *data;
+	uint64_t head;
+	size_t len;		/* of the payload so far */
+};
+
+struct tracestack {
+	uint32_t hash;
+	uint32_t nframes;
+	size_t id;
+	uintptr_t frames[TRACE_MAXFRAMES];
+};
+
+struct tracemapseg {
+	uintptr_t lo;
+	uintptr_t hi;
+};
+
+struct tracemap {
+	size_t nalloc;
+	size_t nsegs;
+	uintptr_t id;
+	struct tracemapseg segs[];
+};
+
+struct tracemapcount {
+	uintptr_t id;
+	size_t nphdr;
+};
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+/* For dlsym(), which allocates while we look up the real functions. */
+static uint8_t bootstrap[TRACE_BOOTSTRAP] __attribute__((aligned(16)));
+static size_t bootstraplen;
+static int resolving;
+
+static struct mring_hdr *ring;
+static int tracing;
+static pid_t tracepid;
+
+static TLS pid_t tracetid;
+static TLS int tracebusy;	/* don't trace malloc calls of our own */
+
+static pthread_mutex_t stacklock = PTHREAD_MUTEX_INITIALIZER;
+static struct tracestack *stacks;
+static size_t nstacks;
+
+static struct tracemap *volatile tracemap;
+static pthread_mutex_t maplock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Ring buffer
+ */
+
+static void
+trace_ringopen(const char *path)
+{
+	struct mring_hdr *h;
+	char tmp[PATH_MAX];
+	size_t size;
+	int fd;
+
+	size = MRING_ALIGN * (TRACE_NRINGS + 1) +
+	    (size_t)TRACE_NRINGS * TRACE_RINGSIZE;
+	/* mdump must never see a half made ring. */
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >=
+	    sizeof(tmp) || (fd = mkstemp(tmp)) == -1)
+		return;
+	if (ftruncate(fd, size) == -1 || (h = mmap(NULL, size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+	h->nrings = TRACE_NRINGS;
+	h->ringsize = TRACE_RINGSIZE;
+	h->pid = getpid();
+	h->start = time(NULL);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(h->magic, MRING_MAGIC, sizeof(h->magic));
+	if (rename(tmp, path) == -1) {
+		munmap(h, size);
+		unlink(tmp);
+		return;
+	}
+	ring = h;
+}
+
+static pid_t
+trace_tid(void)
+{
+	if (tracetid == 0)
+		tracetid = syscall(SYS_gettid);
+	return tracetid;
+}
+
+/* Copy to off bytes into the record, which may wrap around. */
+static void
+trace_copy(struct tracewr *w, size_t off, const void *buf, size_t len)
+{
+	uint64_t pos = (w->head + off) & (ring->ringsize - 1);
+	size_t n = len < ring->ringsize - pos ? len : ring->ringsize - pos;
+
+	memcpy(w->data + pos, buf, n);
+	memcpy(w->data, (const uint8_t *)buf + n, len - n);
+}
+
+static void
+trace_put(struct tracewr *w, const void *buf, size_t len)
+{
+	trace_copy(w, sizeof(struct mring_rec) + w->len, buf, len);
+	w->len += len;
+}
+
+/*
+ * Take a ring with room for a record of up to len bytes, preferably the
+ * one of this thread, and wait if there is none.  Only then the record
+ * gets its number, so mdump never waits for a record whose writer waits
+ * for mdump.
+ */
+static void
+trace_begin(struct tracewr *w, size_t len, uint64_t *seq)
+{
+	uint32_t tid = trace_tid(), i;
+	size_t reclen = (sizeof(struct mring_rec) + len + 7) & ~(size_t)7;
+
+	for (i = 0;; i++) {
+		if (i % ring->nrings == 0 && i != 0)
+			sched_yield();
+		w->r = MRING(ring, (tid + i) % ring->nrings);
+		if (w->r->owner != 0 ||
+		    !__sync_bool_compare_and_swap(&w->r->owner, 0, tid))
+			continue;
+		w->head = w->r->head;
+		if (ring->ringsize - (w->head -
+		    __atomic_load_n(&w->r->tail, __ATOMIC_ACQUIRE)) >= reclen)
+			break;
+		__atomic_store_n(&w->r->owner, 0, __ATOMIC_RELEASE);
+	}
+	w->data = MRING_DATA(ring, (tid + i) % ring->nrings);
+	w->len = 0;
+	*seq = __atomic_fetch_add(&ring->seq, 1, __ATOMIC_RELAXED);
+}
+
+static void
+trace_commit(struct tracewr *w, const char *id, uint64_t seq)
+{
+	struct mring_rec rec;
+	size_t len = w->len;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.seq = seq;
+	rec.pid = tracepid;
+	rec.tid = trace_tid();
+	rec.len = len;
+	memcpy(rec.id, id, strnlen(id, sizeof(rec.id)));
+	trace_copy(w, 0, &rec, sizeof(rec));
+	__atomic_store_n(&w->r->head, w->head +
+	    ((sizeof(rec) + len + 7) & ~(size_t)7), __ATOMIC_RELEASE);
+	__atomic_store_n(&w->r->owner, 0, __ATOMIC_RELEASE);
+}
+
+static void
+trace_utrace(const char *id, const void *buf, size_t len)
+{
+	struct tracewr w;
+	uint64_t seq;
+
+	trace_begin(&w, len, &seq);
+	trace_put(&w, buf, len);
+	trace_commit(&w, id, seq);
+}
+
+/*
+ * Load map, as in malloc.diff
+ */
+
+static int
+trace_mapped(struct tracemap *m, uintptr_t f)
+{
+	size_t lo = 0, hi, mid;
+
+	if (m == NULL)
+		return 0;
+	hi = m->nsegs;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (f < m->segs[mid].lo)
+			hi = mid;
+		else if (f >= m->segs[mid].hi)
+			lo = mid + 1;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+static int
+trace_mapcount(struct dl_phdr_info *info, size_t size, void *arg)
+{
+	struct tracemapcount *c = arg;
+
+	c->id = c->id * 31 + (info->dlpi_addr ^ (uintptr_t)info->dlpi_phdr);
+	c->nphdr += info->dlpi_phnum;
+	return 0;
+}
+
+static const uint8_t *
+trace_buildid(const uint8_t *p, size_t len, size_t *idlen)
+{
+	uint32_t namesz, descsz, type;
+	size_t n, d;
+
+	while (len >= 3 * sizeof(uint32_t)) {
+		memcpy(&namesz, p, sizeof(namesz));
+		memcpy(&descsz, p + 4, sizeof(descsz));
+		memcpy(&type, p + 8, sizeof(type));
+		p += 3 * sizeof(uint32_t);
+		len -= 3 * sizeof(uint32_t);
+		n = (namesz + 3) & ~3;
+		d = (descsz + 3) & ~3;
+		if (n > len || d > len - n)
+			break;
+		if (type == TRACE_NT_GNU_BUILD_ID && namesz == 4 &&
+		    memcmp(p, "GNU", 4) == 0) {
+			*idlen = descsz;
+			return p + n;
+		}
+		p += n + d;
+		len -= n + d;
+	}
+	return NULL;
+}
+
+static int
+trace_mapobj(struct dl_phdr_info *info, size_t size, void *arg)
+{
+	struct tracemap *m = arg;
+	struct malloc_mapobj obj;
+	struct tracemapseg seg;
+	const ElfW(Phdr) *ph;
+	const uint8_t *id = NULL;
+	uint8_t rec[KTR_USER_MAXLEN];
+	size_t len = sizeof(obj), idlen = 0, i;
+	ssize_t n;
+
+	/* Nothing to read symbols from, like the vdso. */
+	if (info->dlpi_name != NULL && info->dlpi_name[0] != '\0' &&
+	    strchr(info->dlpi_name, '/') == NULL)
+		return 0;
+
+	obj.base = info->dlpi_addr;
+	obj.nsegs = 0;
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		ph = &info->dlpi_phdr[i];
+		if (ph->p_type == PT_NOTE && id == NULL)
+			id = trace_buildid((uint8_t *)(info->dlpi_addr +
+			    ph->p_vaddr), ph->p_filesz, &idlen);
+		if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X) ||
+		    m->nsegs == m->nalloc || len + sizeof(seg) > sizeof(rec))
+			continue;
+		seg.lo = info->dlpi_addr + ph->p_vaddr;
+		seg.hi = seg.lo + ph->p_memsz;
+		memcpy(rec + len, &seg, sizeof(seg));
+		len += sizeof(seg);
+		m->segs[m->nsegs++] = seg;
+		obj.nsegs++;
+	}
+	if (obj.nsegs == 0)
+		return 0;
+
+	obj.idlen = 0;
+	if (id != NULL && idlen <= sizeof(rec) - len) {
+		memcpy(rec + len, id, idlen);
+		obj.idlen = idlen;
+		len += idlen;
+	}
+	/* The executable has no name here. */
+	obj.namelen = 0;
+	if (info->dlpi_name != NULL && info->dlpi_name[0] != '\0') {
+		obj.namelen = strnlen(info->dlpi_name, sizeof(rec) - len);
+		memcpy(rec + len, info->dlpi_name, obj.namelen);
+	} else if ((n = readlink("/proc/self/exe", (char *)rec + len,
+	    sizeof(rec) - len)) != -1)
+		obj.namelen = n;
+	len += obj.namelen;
+	memcpy(rec, &obj, sizeof(obj));
+	trace_utrace("malloctrmap", rec, len);
+	return 0;
+}
+
+/*
+ * Make sure the object frame f is in has been announced.
+ */
+static void
+trace_object(uintptr_t f)
+{
+	struct tracemap *m;
+	struct tracemapcount c;
+	struct tracemapseg seg;
+	size_t i, j;
+
+	if (f == 0 ||
+	    trace_mapped(__atomic_load_n(&tracemap, __ATOMIC_ACQUIRE), f))
+		return;
+
+	pthread_mutex_lock(&maplock);
+	if (trace_mapped(tracemap, f))
+		goto done;
+	c.id = 0;
+	c.nphdr = 0;
+	dl_iterate_phdr(trace_mapcount, &c);
+	/* Not in any object, e.g. generated code. */
+	if (tracemap != NULL && tracemap->id == c.id)
+		goto done;
+
+	/* Old maps might still be read, they are never unmapped. */
+	if ((m = mmap(NULL, sizeof(*m) + c.nphdr * sizeof(m->segs[0]),
+	    PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0)) ==
+	    MAP_FAILED)
+		goto done;
+	m->nalloc = c.nphdr;
+	m->nsegs = 0;
+	m->id = c.id;
+	dl_iterate_phdr(trace_mapobj, m);
+	for (i = 1; i < m->nsegs; i++) {
+		seg = m->segs[i];
+		for (j = i; j > 0 && m->segs[j - 1].lo > seg.lo; j--)
+			m->segs[j] = m->segs[j - 1];
+		m->segs[j] = seg;
+	}
+	__atomic_store_n(&tracemap, m, __ATOMIC_RELEASE);
+
+ done:
+	pthread_mutex_unlock(&maplock);
+}
+
+/*
+ * Backtraces and their ids
+ */
+
+static __attribute__((noinline)) size_t
+trace_backtrace(uintptr_t *frames)
+{
+	void *bt[TRACE_MAXFRAMES + TRACE_SKIP];
+	int n, i;
+
+	n = backtrace(bt, TRACE_MAXFRAMES + TRACE_SKIP);
+	for (i = TRACE_SKIP; i < n; i++) {
+		frames[i - TRACE_SKIP] = (uintptr_t)bt[i];
+		trace_object(frames[i - TRACE_SKIP]);
+	}
+	return n > TRACE_SKIP ? n - TRACE_SKIP : 0;
+}
+
+/*
+ * The id of a stack, announcing it if it is new.  Announcing under the
+ * lock makes sure nobody uses the id before.
+ */
+static size_t
+trace_stack(const uintptr_t *frames, size_t nframes)
+{
+	struct tracestack *st;
+	struct malloc_batchent ent;
+	struct tracewr w;
+	uint64_t seq;
+	uint32_t h = 2166136261U;
+	size_t i, id;
+
+	for (i = 0; i < nframes * sizeof(*frames); i++)
+		h = (h ^ ((const uint8_t *)frames)[i]) * 16777619;
+
+	pthread_mutex_lock(&stacklock);
+	if (stacks == NULL && (stacks = mmap(NULL, TRACE_STACKS *
+	    sizeof(*stacks), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+	    -1, 0)) == MAP_FAILED)
+		stacks = NULL;
+	for (i = 0; stacks != NULL && i < TRACE_STACKS; i++) {
+		st = &stacks[(h + i) % TRACE_STACKS];
+		if (st->nframes == 0)
+			break;
+		if (st->hash == h && st->nframes == nframes + 1 &&
+		    memcmp(st->frames, frames,
+		    nframes * sizeof(*frames)) == 0) {
+			id = st->id;
+			pthread_mutex_unlock(&stacklock);
+			return id;
+		}
+	}
+	id = nstacks++;
+	/* A full table means announcing stacks again, under a new id. */
+	if (stacks != NULL && i < TRACE_STACKS &&
+	    nstacks < TRACE_STACKS / 4 * 3) {
+		st->hash = h;
+		st->nframes = nframes + 1;	/* 0 is a free slot */
+		st->id = id;
+		memcpy(st->frames, frames, nframes * sizeof(*frames));
+	}
+
+	ent.type = MALLOC_TRACE_STACK;
+	ent.len = sizeof(id) + nframes * sizeof(*frames);
+	trace_begin(&w, sizeof(ent) + ent.len, &seq);
+	trace_put(&w, &ent, sizeof(ent));
+	trace_put(&w, &id, sizeof(id));
+	trace_put(&w, frames, nframes * sizeof(*frames));
+	trace_commit(&w, "mallocbatch", seq);
+	pthread_mutex_unlock(&stacklock);
+	return id;
+}
+
+static void
+trace_record(int type, const void *rec, size_t len)
+{
+	struct malloc_batchent ent;
+	struct tracewr w;
+	uint64_t seq;
+
+	ent.type = type;
+	ent.len = len;
+	trace_begin(&w, sizeof(ent) + len, &seq);
+	trace_put(&w, &ent, sizeof(ent));
+	trace_put(&w, rec, len);
+	trace_commit(&w, "mallocbatch", seq);
+}
+
+static __attribute__((always_inline)) inline size_t
+trace_enter(void)
+{
+	uintptr_t frames[TRACE_MAXFRAMES];
+	size_t n;
+
+	tracebusy = 1;
+	n = trace_backtrace(frames);
+	return trace_stack(frames, n);
+}
+
+static void
+trace_malloc(void *p, size_t sz, size_t stack)
+{
+	struct malloc_trace t;
+
+	t.p = (uintptr_t)p;
+	t.sz = sz;
+	t.stack = stack;
+	trace_record(MALLOC_TRACE_MALLOC, &t, sizeof(t));
+}
+
+/*
+ * Initialization
+ */
+
+/* So no other thread holds our locks when the child is made. */
+static void
+trace_prefork(void)
+{
+	pthread_mutex_lock(&maplock);
+	pthread_mutex_lock(&stacklock);
+}
+
+static void
+trace_postfork(void)
+{
+	pthread_mutex_unlock(&stacklock);
+	pthread_mutex_unlock(&maplock);
+}
+
+/* The stacks are announced again under the pid of the child. */
+static void
+trace_atfork(void)
+{
+	tracepid = getpid();
+	tracetid = 0;
+	if (stacks != NULL)
+		munmap(stacks, TRACE_STACKS * sizeof(*stacks));
+	stacks = NULL;
+	nstacks = 0;
+	trace_postfork();
+}
+
+static void
+trace_resolve(void)
+{
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	resolving = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_free == NULL)
+		abort();
+}
+
+static __attribute__((constructor)) void
+trace_init(void)
+{
+	const char *path;
+	void *bt[1];
+
+	if (real_malloc == NULL)
+		trace_resolve();
+	if ((path = getenv("MALLOC_TRACEFILE")) == NULL)
+		return;
+	tracebusy = 1;
+	/* The first backtrace() loads libgcc_s, which allocates. */
+	backtrace(bt, 1);
+	trace_ringopen(path);
+	tracepid = getpid();
+	pthread_atfork(trace_prefork, trace_postfork, trace_atfork);
+	tracebusy = 0;
+	tracing = ring != NULL;
+}
+
+static void *
+bootstrap_alloc(size_t sz)
+{
+	void *p;
+
+	sz = (sz + 15) & ~(size_t)15;
+	if (sz > sizeof(bootstrap) - bootstraplen)
+		return NULL;
+	p = bootstrap + bootstraplen;
+	bootstraplen += sz;
+	return p;
+}
+
+static int
+bootstrap_ptr(void *p)
+{
+	return (uint8_t *)p >= bootstrap &&
+	    (uint8_t *)p < bootstrap + sizeof(bootstrap);
+}
+
+/*
+ * The interposed functions
+ */
+
+void *
+malloc(size_t sz)
+{
+	size_t stack;
+	void *p;
+
+	if (real_malloc == NULL) {
+		if (resolving)
+			return bootstrap_alloc(sz);
+		trace_resolve();
+	}
+	if (!tracing || tracebusy)
+		return real_malloc(sz);
+	stack = trace_enter();
+	if ((p = real_malloc(sz)) != NULL)
+		trace_malloc(p, sz, stack);
+	tracebusy = 0;
+	return p;
+}
+
+void *
+calloc(size_t n, size_t sz)
+{
+	size_t stack;
+	void *p;
+
+	if (real_calloc == NULL) {
+		/* bootstrap is zeroed, and never reused */
+		if (resolving)
+			return n != 0 && sz > SIZE_MAX / n ? NULL :
+			    bootstrap_alloc(n * sz);
+		trace_resolve();
+	}
+	if (!tracing || tracebusy)
+		return real_calloc(n, sz);
+	stack = trace_enter();
+	if ((p = real_calloc(n, sz)) != NULL)
+		trace_malloc(p, n * sz, stack);
+	tracebusy = 0;
+	return p;
+}
+
+void *
+realloc(void *origp, size_t sz)
+{
+	struct realloc_trace t;
+	struct malloc_batchent ent;
+	struct tracewr w;
+	uint64_t seq;
+	void *p;
+
+	if (bootstrap_ptr(origp)) {
+		if ((p = malloc(sz)) != NULL)
+			memcpy(p, origp, MIN(sz, (size_t)(bootstrap +
+			    bootstraplen - (uint8_t *)origp)));
+		return p;
+	}
+	if (real_realloc == NULL)
+		trace_resolve();
+	if (!tracing || tracebusy)
+		return real_realloc(origp, sz);
+
+	t.stack = trace_enter();
+	/*
+	 * Number the record before the old chunk is freed, so its reuse by
+	 * another thread comes after it.
+	 */
+	ent.type = MALLOC_TRACE_REALLOC;
+	ent.len = sizeof(t);
+	trace_begin(&w, sizeof(ent) + sizeof(t), &seq);
+	p = real_realloc(origp, sz);
+	if (p != NULL || (origp != NULL && sz == 0)) {
+		t.p = (uintptr_t)p;
+		t.origp = (uintptr_t)origp;
+		t.sz = sz;
+		trace_put(&w, &ent, sizeof(ent));
+		trace_put(&w, &t, sizeof(t));
+	}
+	/* Failed: an empty batch. */
+	trace_commit(&w, "mallocbatch", seq);
+	tracebusy = 0;
+	return p;
+}
+
+void
+free(void *p)
+{
+	struct free_trace t;
+
+	if (p == NULL || bootstrap_ptr(p))
+		return;
+	if (real_free == NULL)
+		trace_resolve();
+	if (tracing && !tracebusy) {
+		/* Before, so the chunk can't be reused before this record. */
+		t.stack = trace_enter();
+		t.p = (uintptr_t)p;
+		trace_record(MALLOC_TRACE_FREE, &t, sizeof(t));
+		tracebusy = 0;
+	}
+	real_free(p);
+}
+
+int
+posix_memalign(void **pp, size_t align, size_t sz)
+{
+	size_t stack;
+	int ret;
+
+	if (real_posix_memalign == NULL)
+		trace_resolve();
+	if (!tracing || tracebusy)
+		return real_posix_memalign(pp, align, sz);
+	stack = trace_enter();
+	if ((ret = real_posix_memalign(pp, align, sz)) == 0)
+		trace_malloc(*pp, sz, stack);
+	tracebusy = 0;
+	return ret;
+}
+
+void *
+aligned_alloc(size_t align, size_t sz)
+{
+	size_t stack;
+	void *p;
+
+	if (real_aligned_alloc == NULL)
+		trace_resolve();
+	if (!tracing || tracebusy)
+		return real_aligned_alloc(align, sz);
+	stack = trace_enter();
+	if ((p = real_aligned_alloc(align, sz)) != NULL)
+		trace_malloc(p, sz, stack);
+	tracebusy = 0;
+	return p;
+}
+
+void *
+memalign(size_t align, size_t sz)
+{
+	size_t stack;
+	void *p;
+
+	if (real_memalign == NULL)
+		trace_resolve();
+	if (!tracing || tracebusy)
+		return real_memalign(align, sz);
+	stack = trace_enter();
+	if ((p = real_memalign(align, sz)) != NULL)
+		trace_malloc(p, sz, stack);
+	tracebusy = 0;
+	return p;
+}
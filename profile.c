@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Per allocation site profiles and the difference between two of them.
+ *
+ * Sites are identified by their symbolized stack, so profiles taken from
+ * different builds or runs of a program (with different load addresses)
+ * line up.  A profile is either computed from a replayed trace or read
+ * back from a file written with -o:
+ *
+ *	# mdump profile 1
+ *	total <leaked> <maximum>
+ *	site <allocations> <peak> <leaked>
+ *	<tab><symbolized frame line>
+ *	...
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+#define PROFILE_MAGIC	"# mdump profile 1\n"
+
+struct site {
+	char *key;		/* symbolized stack */
+	uint64_t hash;
+	size_t count;
+	size_t peak;
+	size_t leaked;
+	int matched;
+	struct site *next;
+};
+
+struct profile {
+	struct site **tab;
+	size_t size;		/* power of two */
+	size_t nsites;
+	size_t leaked;
+	size_t max;
+};
+
+struct sitediff {
+	const char *key;
+	struct site *old;
+	struct site *new;
+};
+
+static struct site zerosite;
+
+static uint64_t
+profile_hash(const char *key)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char)*key;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static void
+profile_init(struct profile *prof)
+{
+	prof->size = 1024;
+	if ((prof->tab = calloc(prof->size, sizeof(*prof->tab))) == NULL)
+		err(1, NULL);
+	prof->nsites = 0;
+	prof->leaked = prof->max = 0;
+}
+
+static void
+profile_grow(struct profile *prof)
+{
+	struct site **tab, *s, *next;
+	size_t i, size;
+
+	size = prof->size * 2;
+	if ((tab = calloc(size, sizeof(*tab))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < prof->size; i++) {
+		for (s = prof->tab[i]; s != NULL; s = next) {
+			next = s->next;
+			s->next = tab[s->hash & (size - 1)];
+			tab[s->hash & (size - 1)] = s;
+		}
+	}
+	free(prof->tab);
+	prof->tab = tab;
+	prof->size = size;
+}
+
+static struct site *
+profile_lookup(struct profile *prof, const char *key, uint64_t hash)
+{
+	struct site *s;
+
+	for (s = prof->tab[hash & (prof->size - 1)]; s != NULL; s = s->next)
+		if (s->hash == hash && strcmp(s->key, key) == 0)
+			return s;
+	return NULL;
+}
+
+/*
+ * Add a site to the profile, taking ownership of key.  Different raw
+ * stacks can symbolize identically; their counters are summed.
+ */
+static void
+profile_add(struct profile *prof, char *key, size_t count, size_t peak,
+    size_t leaked)
+{
+	struct site *s;
+	uint64_t hash;
+
+	hash = profile_hash(key);
+	if ((s = profile_lookup(prof, key, hash)) != NULL) {
+		s->count += count;
+		s->peak += peak;
+		s->leaked += leaked;
+		free(key);
+		return;
+	}
+	if (prof->nsites >= prof->size)
+		profile_grow(prof);
+	s = xmalloc(sizeof(*s));
+	s->key = key;
+	s->hash = hash;
+	s->count = count;
+	s->peak = peak;
+	s->leaked = leaked;
+	s->matched = 0;
+	s->next = prof->tab[hash & (prof->size - 1)];
+	prof->tab[hash & (prof->size - 1)] = s;
+	prof->nsites++;
+}
+
+static void
+profile_fromstate(struct profile *prof)
+{
+	struct stack *st;
+	char *key;
+	size_t keylen;
+	FILE *fp;
+
+	RB_FOREACH(st, stackshead, &stacks) {
+		if (st->count == 0)
+			continue;
+		if ((fp = open_memstream(&key, &keylen)) == NULL)
+			err(1, NULL);
+		stack_print(fp, st);
+		if (fclose(fp) == EOF)
+			err(1, NULL);
+		profile_add(prof, key, st->count, st->max, st->cur);
+	}
+	prof->leaked = mcur;
+	prof->max = mmax;
+}
+
+static void
+profile_read(struct profile *prof, const char *file)
+{
+	FILE *fp;
+	char *line = NULL, *key = NULL;
+	size_t linesize = 0, keylen = 0, count = 0, peak = 0, leaked = 0;
+	ssize_t linelen;
+	unsigned long long v1, v2, v3;
+	int lineno = 1;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	if ((linelen = getline(&line, &linesize, fp)) == -1 ||
+	    strcmp(line, PROFILE_MAGIC) != 0)
+		errx(1, "%s: not a profile", file);
+	while ((linelen = getline(&line, &linesize, fp)) != -1) {
+		lineno++;
+		if (line[0] == '\t') {
+			if (key == NULL)
+				errx(1, "%s:%d: frame outside site", file,
+				    lineno);
+			if ((key = realloc(key, keylen + linelen)) == NULL)
+				err(1, NULL);
+			memcpy(key + keylen, line + 1, linelen);
+			keylen += linelen - 1;
+			continue;
+		}
+		if (key != NULL) {
+			profile_add(prof, key, count, peak, leaked);
+			key = NULL;
+		}
+		if (sscanf(line, "site %llu %llu %llu", &v1, &v2, &v3) == 3) {
+			count = v1;
+			peak = v2;
+			leaked = v3;
+			if ((key = strdup("")) == NULL)
+				err(1, NULL);
+			keylen = 0;
+		} else if (sscanf(line, "total %llu %llu", &v1, &v2) == 2) {
+			prof->leaked = v1;
+			prof->max = v2;
+		} else
+			errx(1, "%s:%d: invalid line", file, lineno);
+	}
+	if (ferror(fp))
+		err(1, "%s", file);
+	if (key != NULL)
+		profile_add(prof, key, count, peak, leaked);
+	free(line);
+	fclose(fp);
+}
+
+static void
+profile_printkey(FILE *fp, const char *key)
+{
+	const char *nl;
+
+	for (; *key != '\0'; key = nl + 1) {
+		if ((nl = strchr(key, '\n')) == NULL) {
+			fprintf(fp, "\t%s\n", key);
+			return;
+		}
+		fprintf(fp, "\t%.*s\n", (int)(nl - key), key);
+	}
+}
+
+void
+profile_write(FILE *fp)
+{
+	struct profile prof;
+	struct site *s;
+	size_t i;
+
+	profile_init(&prof);
+	profile_fromstate(&prof);
+	fprintf(fp, "%s", PROFILE_MAGIC);
+	fprintf(fp, "total %zu %zu\n", prof.leaked, prof.max);
+	for (i = 0; i < prof.size; i++) {
+		for (s = prof.tab[i]; s != NULL; s = s->next) {
+			fprintf(fp, "site %zu %zu %zu\n", s->count, s->peak,
+			    s->leaked);
+			profile_printkey(fp, s->key);
+		}
+	}
+}
+
+/*
+ * Return 1 if file holds a ktrace dump, 0 if it is a profile.
+ */
+static int
+profile_istrace(const char *file)
+{
+	FILE *fp;
+	struct ktr_header hdr;
+	char magic[sizeof(PROFILE_MAGIC) - 1];
+	int istrace;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	if (fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	    (hdr.ktr_type == htobe32(KTR_START) ||
+	    input_magic((uint8_t *)&hdr, sizeof(hdr)) != INPUT_RAW))
+		istrace = 1;
+	else {
+		rewind(fp);
+		if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+		    memcmp(magic, PROFILE_MAGIC, sizeof(magic)) != 0)
+			errx(1, "%s: neither a dump nor a profile", file);
+		istrace = 0;
+	}
+	fclose(fp);
+	return istrace;
+}
+
+static size_t
+absdiff(size_t a, size_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static int
+sitediffcmp(const void *v1, const void *v2)
+{
+	const struct sitediff *d1 = v1, *d2 = v2;
+	size_t c1, c2;
+
+	c1 = absdiff(d1->new->peak, d1->old->peak);
+	c2 = absdiff(d2->new->peak, d2->old->peak);
+	if (c1 != c2)
+		return c1 > c2 ? -1 : 1;
+	c1 = absdiff(d1->new->leaked, d1->old->leaked);
+	c2 = absdiff(d2->new->leaked, d2->old->leaked);
+	if (c1 != c2)
+		return c1 > c2 ? -1 : 1;
+	c1 = absdiff(d1->new->count, d1->old->count);
+	c2 = absdiff(d2->new->count, d2->old->count);
+	if (c1 != c2)
+		return c1 > c2 ? -1 : 1;
+	return 0;
+}
+
+static void
+printdelta(const char *what, size_t old, size_t new)
+{
+	printf("%s %c%zu (%zu -> %zu)", what, new >= old ? '+' : '-',
+	    absdiff(new, old), old, new);
+}
+
+/*
+ * Compare the replayed trace against base, which is either another trace
+ * or a profile, and report the sites that changed, biggest change first.
+ */
+void
+profile_diff(const char *base)
+{
+	struct profile new, old;
+	struct sitediff *diffs;
+	struct site *s, *o;
+	size_t i, ndiffs;
+
+	profile_init(&new);
+	profile_fromstate(&new);
+	profile_init(&old);
+	if (profile_istrace(base)) {
+		replay_reset();
+		replay(base, 0);
+		profile_fromstate(&old);
+	} else
+		profile_read(&old, base);
+
+	if ((diffs = reallocarray(NULL, new.nsites + old.nsites,
+	    sizeof(*diffs))) == NULL)
+		err(1, NULL);
+	ndiffs = 0;
+	for (i = 0; i < new.size; i++) {
+		for (s = new.tab[i]; s != NULL; s = s->next) {
+			if ((o = profile_lookup(&old, s->key, s->hash)) != NULL)
+				o->matched = 1;
+			else
+				o = &zerosite;
+			if (o->count == s->count && o->peak == s->peak &&
+			    o->leaked == s->leaked)
+				continue;
+			diffs[ndiffs].key = s->key;
+			diffs[ndiffs].new = s;
+			diffs[ndiffs++].old = o;
+		}
+	}
+	for (i = 0; i < old.size; i++) {
+		for (o = old.tab[i]; o != NULL; o = o->next) {
+			if (o->matched)
+				continue;
+			diffs[ndiffs].key = o->key;
+			diffs[ndiffs].new = &zerosite;
+			diffs[ndiffs++].old = o;
+		}
+	}
+	qsort(diffs, ndiffs, sizeof(*diffs), sitediffcmp);
+
+	if (ndiffs > 0)
+		printf("Changed allocation sites (relative to %s):\n", base);
+	for (i = 0; i < ndiffs; i++) {
+		printdelta("peak", diffs[i].old->peak, diffs[i].new->peak);
+		printdelta(", leaked", diffs[i].old->leaked,
+		    diffs[i].new->leaked);
+		printdelta(", allocations", diffs[i].old->count,
+		    diffs[i].new->count);
+		printf(":\n");
+		profile_printkey(stdout, diffs[i].key);
+	}
+	printdelta("Total memory leaked:", old.leaked, new.leaked);
+	printf("\n");
+	printdelta("Maximum memory:", old.max, new.max);
+	printf("\n");
+	free(diffs);
+}
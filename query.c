@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Queries about the replay state while following a trace (-s).  The
+ * socket is looked at every QUERY_RECORDS records and while waiting for
+ * the trace.  Every connection gets a child of its own: it has a copy of
+ * the replay state as it was between two records, reads one query,
+ * answers it and exits, while the parent goes on replaying.  Spill files
+ * are copied on write into the children too, see live.c.
+ *
+ *	summary		totals
+ *	top [n]		the n sites with the most live bytes
+ *	peak [n]	when the peak was, and the n sites with the highest
+ *			peaks of their own
+ *	threads		allocations and frees per thread
+ *	growth [n]	the n sites growing fastest, with -g
+ *	pages [n]	pages in use, and the n sites holding on to the
+ *			most sparse pages, with -u
+ *	anomalies [n]	records not matching the live set, the n stacks
+ *			with the most of them
+ *	ptr addr	the live allocation at addr
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/tree.h>
+#include <sys/un.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdump.h"
+
+#define QUERY_RECORDS	1024	/* records between looking at the socket */
+#define QUERY_TIMEOUT	30	/* seconds a child may take */
+#define QUERY_TOP	10
+#define QUERY_MAXTOP	1000
+#define QUERY_LINEMAX	256
+
+RB_HEAD(qthreads, qthread);
+RB_PROTOTYPE_STATIC(qthreads, qthread, entry, qthreadcmp)
+
+uint64_t peaktime;		/* trace time mmax was reached */
+
+static struct qthreads qthreads = RB_INITIALIZER(&qthreads);
+static struct qthread *lastthread;
+static size_t nqthreads;
+static int qfd = -1;
+static size_t qrecords;
+
+static int
+qthreadcmp(const struct qthread *t1, const struct qthread *t2)
+{
+	return t1->tid < t2->tid ? -1 : t1->tid > t2->tid;
+}
+
+/*
+ * Listen on the unix socket at path.  A socket left behind by an earlier
+ * run is replaced.
+ */
+void
+query_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat sb;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path))
+		errx(1, "-s %s: name too long", path);
+	if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode) &&
+	    unlink(path) == -1)
+		err(1, "unlink %s", path);
+	if ((qfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1)
+		err(1, "socket");
+	if (bind(qfd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(1, "bind %s", path);
+	if (listen(qfd, 8) == -1)
+		err(1, "listen %s", path);
+	/* Children are never waited for. */
+	if (signal(SIGCHLD, SIG_IGN) == SIG_ERR)
+		err(1, "signal");
+}
+
+/*
+ * Count an allocation or a free of bytes by thread tid.
+ */
+void
+query_thread(uint32_t tid, int alloc, size_t bytes)
+{
+	struct qthread *t, search;
+
+	if (qfd == -1)
+		return;
+	if ((t = lastthread) == NULL || t->tid != tid) {
+		search.tid = tid;
+		if ((t = RB_FIND(qthreads, &qthreads, &search)) == NULL) {
+			t = xmalloc(sizeof(*t));
+			memset(t, 0, sizeof(*t));
+			t->tid = tid;
+			RB_INSERT(qthreads, &qthreads, t);
+			nqthreads++;
+		}
+		lastthread = t;
+	}
+	if (alloc) {
+		t->nalloc++;
+		t->allocated += bytes;
+		if (mcur == mmax)
+			peaktime = tracenow;
+	} else {
+		t->nfree++;
+		t->freed += bytes;
+	}
+}
+
+size_t
+query_nthreads(void)
+{
+	return nqthreads;
+}
+
+void
+query_foreachthread(void (*fn)(const struct qthread *, void *), void *arg)
+{
+	struct qthread *t;
+
+	RB_FOREACH(t, qthreads, &qthreads)
+		fn(t, arg);
+}
+
+/* Add a thread saved with query_foreachthread(), e.g. in a checkpoint. */
+void
+query_restorethread(const struct qthread *saved)
+{
+	struct qthread *t;
+
+	t = xmalloc(sizeof(*t));
+	*t = *saved;
+	if (RB_INSERT(qthreads, &qthreads, t) != NULL)
+		errx(1, "duplicate thread %u", t->tid);
+	nqthreads++;
+	lastthread = t;
+}
+
+static void
+query_summary(FILE *fp)
+{
+	fprintf(fp, "%zu bytes live in %zu allocations, peak %zu bytes\n",
+	    mcur, live_count(), mmax);
+	fprintf(fp, "%zu sites, %zu records", nstacks, stats.records);
+	if (tracenow != 0)
+		fprintf(fp, ", %.3fs into the trace", tracenow / 1e9);
+	fputc('\n', fp);
+	if (samplerate != 0)
+		fprintf(fp, "Sampled once every %zu bytes, totals are "
+		    "estimates\n", samplerate);
+}
+
+static int
+curcmp(const void *a, const void *b)
+{
+	const struct stack *s1 = *(struct stack *const *)a;
+	const struct stack *s2 = *(struct stack *const *)b;
+
+	return s1->cur < s2->cur ? 1 : s1->cur > s2->cur ? -1 : 0;
+}
+
+static int
+maxcmp(const void *a, const void *b)
+{
+	const struct stack *s1 = *(struct stack *const *)a;
+	const struct stack *s2 = *(struct stack *const *)b;
+
+	return s1->max < s2->max ? 1 : s1->max > s2->max ? -1 : 0;
+}
+
+/*
+ * The number of sites asked for in arg, or QUERY_TOP.
+ */
+static int
+query_count(FILE *fp, const char *arg, size_t *n)
+{
+	const char *errstr;
+
+	*n = QUERY_TOP;
+	if (*arg == '\0')
+		return 1;
+	*n = strtonum(arg, 1, QUERY_MAXTOP, &errstr);
+	if (errstr != NULL) {
+		fprintf(fp, "%s: %s\n", arg, errstr);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The sites with the most live bytes (peak 0) or with the highest peaks.
+ */
+static void
+query_top(FILE *fp, const char *arg, int peak)
+{
+	struct stack *st, **top;
+	size_t n = 0, i, ntop;
+
+	if (!query_count(fp, arg, &ntop))
+		return;
+	if (peak) {
+		fprintf(fp, "Peak of %zu bytes", mmax);
+		if (peaktime != 0)
+			fprintf(fp, ", %.3fs into the trace", peaktime / 1e9);
+		fputc('\n', fp);
+	}
+
+	top = xmalloc(nstacks * sizeof(*top) + 1);
+	RB_FOREACH(st, stackshead, &stacks)
+		if ((peak ? st->max : st->cur) != 0)
+			top[n++] = st;
+	qsort(top, n, sizeof(*top), peak ? maxcmp : curcmp);
+	for (i = 0; i < n && i < ntop; i++) {
+		if (peak)
+			fprintf(fp, "%zu bytes at its peak, %zu live now, "
+			    "from:\n", top[i]->max, top[i]->cur);
+		else
+			fprintf(fp, "%zu bytes live, peak %zu, %zu "
+			    "allocations made, from:\n", top[i]->cur,
+			    top[i]->max, top[i]->count);
+		stack_print(fp, top[i]);
+	}
+	free(top);
+}
+
+static void
+query_threads(FILE *fp)
+{
+	struct qthread *t;
+
+	/* Without timestamps, everything is counted as thread 0. */
+	if (nqthreads == 0 || (nqthreads == 1 && lastthread->tid == 0)) {
+		fprintf(fp, "No thread ids in the trace, see the K malloc "
+		    "option\n");
+		return;
+	}
+	fprintf(fp, "%10s %12s %12s %16s %16s\n", "thread", "allocations",
+	    "frees", "bytes allocated", "bytes freed");
+	RB_FOREACH(t, qthreads, &qthreads)
+		fprintf(fp, "%10u %12zu %12zu %16zu %16zu\n", t->tid,
+		    t->nalloc, t->nfree, t->allocated, t->freed);
+}
+
+static void
+query_ptr(FILE *fp, const char *arg)
+{
+	struct malloc m;
+	unsigned long long v;
+	char *ep;
+
+	errno = 0;
+	v = strtoull(arg, &ep, 16);
+	if (*arg == '\0' || *ep != '\0' || errno != 0 || v > UINTPTR_MAX) {
+		fprintf(fp, "%s: invalid address\n", arg);
+		return;
+	}
+	if (!live_find(v, &m)) {
+		fprintf(fp, "%p: not live\n", (void *)(uintptr_t)v);
+		return;
+	}
+	if (m.time != 0 && tracenow >= m.time)
+		fprintf(fp, "%p: %zu bytes, %.3fs old:\n", (void *)m.p,
+		    m.size, (tracenow - m.time) / 1e9);
+	else
+		fprintf(fp, "%p: %zu bytes:\n", (void *)m.p, m.size);
+	stack_print(fp, m.stack);
+}
+
+static void
+query_growth(FILE *fp, const char *arg)
+{
+	size_t ntop;
+
+	if (!growth_active()) {
+		fprintf(fp, "Growth is only followed with -g\n");
+		return;
+	}
+	if (!query_count(fp, arg, &ntop))
+		return;
+	growth_report(fp, ntop);
+}
+
+static void
+query_pages(FILE *fp, const char *arg)
+{
+	size_t ntop;
+
+	if (!pages_active()) {
+		fprintf(fp, "Pages are only followed with -u\n");
+		return;
+	}
+	if (!query_count(fp, arg, &ntop))
+		return;
+	pages_report(fp, ntop);
+}
+
+static void
+query_anomalies(FILE *fp, const char *arg)
+{
+	size_t ntop;
+
+	if (!query_count(fp, arg, &ntop))
+		return;
+	if (anomaly_report(fp, ntop) == 0)
+		fprintf(fp, "All records matched the live set\n");
+}
+
+/*
+ * Read one query from fd and answer it.  Runs in the child.
+ */
+static void
+query_serve(int fd)
+{
+	char line[QUERY_LINEMAX], *arg;
+	size_t len;
+	ssize_t n;
+	FILE *fp;
+
+	alarm(QUERY_TIMEOUT);
+	if (fcntl(fd, F_SETFL, 0) == -1)
+		return;
+	for (len = 0; len < sizeof(line) - 1; len += n) {
+		if ((n = read(fd, line + len, sizeof(line) - 1 - len)) <= 0)
+			break;
+		if (memchr(line + len, '\n', n) != NULL) {
+			len += n;
+			break;
+		}
+	}
+	line[len] = '\0';
+	line[strcspn(line, "\r\n")] = '\0';
+	arg = line + strcspn(line, " \t");
+	if (*arg != '\0')
+		*arg++ = '\0';
+	arg += strspn(arg, " \t");
+
+	if ((fp = fdopen(fd, "w")) == NULL)
+		return;
+	if (strcmp(line, "summary") == 0)
+		query_summary(fp);
+	else if (strcmp(line, "top") == 0)
+		query_top(fp, arg, 0);
+	else if (strcmp(line, "peak") == 0)
+		query_top(fp, arg, 1);
+	else if (strcmp(line, "threads") == 0)
+		query_threads(fp);
+	else if (strcmp(line, "ptr") == 0)
+		query_ptr(fp, arg);
+	else if (strcmp(line, "growth") == 0)
+		query_growth(fp, arg);
+	else if (strcmp(line, "pages") == 0)
+		query_pages(fp, arg);
+	else if (strcmp(line, "anomalies") == 0)
+		query_anomalies(fp, arg);
+	else
+		fprintf(fp, "queries: summary, top [n], peak [n], threads, "
+		    "ptr addr, growth [n], pages [n], anomalies [n]\n");
+	fclose(fp);
+}
+
+static void
+query_accept(void)
+{
+	int fd;
+
+	while ((fd = accept(qfd, NULL, NULL)) != -1) {
+		switch (fork()) {
+		case -1:
+			warn("fork");
+			break;
+		case 0:
+			close(qfd);
+			query_serve(fd);
+			_exit(0);
+		}
+		close(fd);
+	}
+	if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR &&
+	    errno != ECONNABORTED)
+		warn("accept");
+}
+
+/*
+ * Called for every record; answers waiting queries now and then.
+ */
+void
+query_check(void)
+{
+	if (qfd == -1 || ++qrecords < QUERY_RECORDS)
+		return;
+	qrecords = 0;
+	query_accept();
+}
+
+/*
+ * Wait secs seconds for more of the trace, answering queries meanwhile.
+ */
+void
+query_wait(int secs)
+{
+	struct pollfd pfd;
+
+	if (qfd == -1) {
+		(void)sleep(secs);
+		return;
+	}
+	pfd.fd = qfd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, secs * 1000) == -1) {
+		if (errno != EINTR)
+			err(1, "poll");
+		return;
+	}
+	if (pfd.revents & POLLIN)
+		query_accept();
+}
+
+RB_GENERATE_STATIC(qthreads, qthread, entry, qthreadcmp)
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The leak report, as text, JSON Lines or CSV (-F).  Standard output
+ * gets one large buffer, so a report of millions of leaks goes out in
+ * big writes, and frames are printed straight from the symbol tables.
+ *
+ * JSON Lines: an object per leak and a summary at the end:
+ *
+ *	{"ptr":"0x1234","size":16,"age":1.5,"stack":[{"function":"f",
+ *	    "file":"f.c","line":3,"inlined_by":[{"function":...}]},...]}
+ *	{"leaked":16,"max":32,"samplerate":0}
+ *
+ * CSV: a header, then a row for every frame of every leak, and one for
+ * every function a frame was inlined into:
+ *
+ *	ptr,size,age,frame,inlined,function,file,line
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+#define REPORT_BUFSIZE	(1024 * 1024)
+
+int report_format = REPORT_TEXT;
+
+void
+report_setformat(const char *arg)
+{
+	if (strcmp(arg, "text") == 0)
+		report_format = REPORT_TEXT;
+	else if (strcmp(arg, "json") == 0)
+		report_format = REPORT_JSON;
+	else if (strcmp(arg, "csv") == 0)
+		report_format = REPORT_CSV;
+	else
+		errx(1, "-F %s: unknown format", arg);
+}
+
+/*
+ * Called before anything is written to stdout.
+ */
+void
+report_init(void)
+{
+	if (setvbuf(stdout, NULL, _IOFBF, REPORT_BUFSIZE) != 0)
+		err(1, "setvbuf");
+}
+
+static void
+json_str(const char *s)
+{
+	unsigned char c;
+
+	putchar('"');
+	for (; (c = *s) != '\0'; s++) {
+		if (c == '"' || c == '\\') {
+			putchar('\\');
+			putchar(c);
+		} else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static void
+json_loc(const struct frame *f)
+{
+	fputs("{\"function\":", stdout);
+	json_str(sym_str(f->func, NULL));
+	fputs(",\"file\":", stdout);
+	json_str(sym_str(f->file, NULL));
+	printf(",\"line\":%lu", f->line);
+}
+
+static void
+json_frame(size_t id)
+{
+	const struct frame *f = frame_get(id);
+
+	json_loc(f);
+	if (f->caller != FRAME_NONE) {
+		fputs(",\"inlined_by\":[", stdout);
+		for (id = f->caller; id != FRAME_NONE; id = f->caller) {
+			f = frame_get(id);
+			json_loc(f);
+			putchar('}');
+			if (f->caller != FRAME_NONE)
+				putchar(',');
+		}
+		putchar(']');
+	}
+	putchar('}');
+}
+
+static void
+csv_str(const char *s)
+{
+	if (strpbrk(s, ",\"\r\n") == NULL) {
+		fputs(s, stdout);
+		return;
+	}
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			putchar('"');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/*
+ * How long ago the allocation was made, or -1 if that isn't known.
+ */
+static double
+leak_age(const struct malloc *mptr)
+{
+	if (mptr->time != 0 && tracenow >= mptr->time)
+		return (tracenow - mptr->time) / 1e9;
+	return -1;
+}
+
+static void
+leak_text(const struct malloc *mptr, void *arg)
+{
+	double age = leak_age(mptr);
+
+	if (age >= 0)
+		printf("%p: %zu bytes, %.3fs old:\n", (void *)mptr->p,
+		    mptr->size, age);
+	else
+		printf("%p: %zu bytes:\n", (void *)mptr->p, mptr->size);
+	stack_print(stdout, mptr->stack);
+}
+
+static void
+leak_json(const struct malloc *mptr, void *arg)
+{
+	const struct stack *st = mptr->stack;
+	double age = leak_age(mptr);
+	size_t i;
+
+	printf("{\"ptr\":\"%p\",\"size\":%zu", (void *)mptr->p, mptr->size);
+	if (age >= 0)
+		printf(",\"age\":%.3f", age);
+	fputs(",\"stack\":[", stdout);
+	for (i = 0; i < st->nobj; i++) {
+		if (i != 0)
+			putchar(',');
+		json_frame(st->obj[i]->frame);
+	}
+	fputs("]}\n", stdout);
+}
+
+static void
+leak_csv(const struct malloc *mptr, void *arg)
+{
+	const struct stack *st = mptr->stack;
+	const struct frame *f;
+	double age = leak_age(mptr);
+	char agebuf[32] = "";
+	size_t i, id;
+	int inlined;
+
+	if (age >= 0)
+		snprintf(agebuf, sizeof(agebuf), "%.3f", age);
+	if (st->nobj == 0)
+		printf("%p,%zu,%s,,,,,\n", (void *)mptr->p, mptr->size,
+		    agebuf);
+	for (i = 0; i < st->nobj; i++) {
+		inlined = 0;
+		for (id = st->obj[i]->frame; id != FRAME_NONE;
+		    id = f->caller) {
+			f = frame_get(id);
+			printf("%p,%zu,%s,%zu,%d,", (void *)mptr->p,
+			    mptr->size, agebuf, i, inlined);
+			csv_str(sym_str(f->func, NULL));
+			putchar(',');
+			csv_str(sym_str(f->file, NULL));
+			printf(",%lu\n", f->line);
+			inlined = 1;
+		}
+	}
+}
+
+/*
+ * Report the allocations still live and the totals.  With watched
+ * addresses, only the totals.
+ */
+void
+report_leaks(void)
+{
+	switch (report_format) {
+	case REPORT_TEXT:
+		if (live_count() != 0 && !watch_active()) {
+			printf("Leaks detected:\n");
+			live_foreach(leak_text, NULL);
+		}
+		if (samplerate != 0)
+			printf("Sampled once every %zu bytes, totals are "
+			    "estimates\n", samplerate);
+		printf("Total memory leaked: %zu\n", mcur);
+		printf("Maximum memory: %zu\n", mmax);
+		break;
+	case REPORT_JSON:
+		if (!watch_active())
+			live_foreach(leak_json, NULL);
+		printf("{\"leaked\":%zu,\"max\":%zu,\"samplerate\":%zu}\n",
+		    mcur, mmax, samplerate);
+		break;
+	case REPORT_CSV:
+		printf("ptr,size,age,frame,inlined,function,file,line\n");
+		if (!watch_active())
+			live_foreach(leak_csv, NULL);
+		break;
+	}
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The state of malloc's pools at exit (-D), from the "mallocdump"
+ * records: how full the region tables, chunk pages and caches were, per
+ * pool and for all of them, to size the caches and pick the number of
+ * pools with.  A pool dumped again, by a later exit, replaces the
+ * earlier one.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+#define STATE_MAXPOOLS	256
+#define STATE_MAXCHUNKS	32
+
+struct pool {
+	int seen;
+	struct malloc_dumppool dp;
+	struct malloc_dumpchunk dc[STATE_MAXCHUNKS];
+};
+
+static struct pool *pools;
+static size_t npools;
+
+void
+state_add(const uint8_t *u, size_t len)
+{
+	struct malloc_dumppool dp;
+	struct pool *pl;
+	size_t n;
+
+	if (len < sizeof(dp))
+		errx(1, "invalid dump record");
+	memcpy(&dp, u, sizeof(dp));
+	if (dp.pool >= STATE_MAXPOOLS || dp.nchunks > STATE_MAXCHUNKS ||
+	    len != sizeof(dp) + dp.nchunks * sizeof(struct malloc_dumpchunk))
+		errx(1, "invalid dump record");
+	if (dp.pool >= npools) {
+		n = dp.pool + 1;
+		if ((pools = recallocarray(pools, npools, n,
+		    sizeof(*pools))) == NULL)
+			err(1, NULL);
+		npools = n;
+	}
+	pl = &pools[dp.pool];
+	pl->seen = 1;
+	pl->dp = dp;
+	memcpy(pl->dc, u + sizeof(dp), dp.nchunks * sizeof(*pl->dc));
+}
+
+static double
+percent(uint64_t n, uint64_t total)
+{
+	return total == 0 ? 0 : 100.0 * n / total;
+}
+
+static void
+state_print(FILE *fp, const struct pool *pl)
+{
+	const struct malloc_dumppool *dp = &pl->dp;
+	const struct malloc_dumpchunk *dc;
+	uint32_t i;
+
+	fprintf(fp, "%llu bytes allocated, %llu in guard pages\n",
+	    (unsigned long long)dp->used, (unsigned long long)dp->guarded);
+	fprintf(fp, "regions: %llu of %llu slots used, %llu allocations of "
+	    "whole pages in %llu pages\n",
+	    (unsigned long long)(dp->regions - dp->regionsfree),
+	    (unsigned long long)dp->regions, (unsigned long long)dp->big,
+	    (unsigned long long)dp->bigpages);
+	fprintf(fp, "small cache: %llu of %llu regions (%.0f%%), %llu pages\n",
+	    (unsigned long long)dp->smallcached,
+	    (unsigned long long)dp->smallslots,
+	    percent(dp->smallcached, dp->smallslots),
+	    (unsigned long long)dp->smallpages);
+	fprintf(fp, "big cache: %llu of %llu slots (%.0f%%), %llu pages\n",
+	    (unsigned long long)dp->bigcached,
+	    (unsigned long long)dp->bigslots,
+	    percent(dp->bigcached, dp->bigslots),
+	    (unsigned long long)dp->bigcachepages);
+	fprintf(fp, "delayed frees: %llu\n", (unsigned long long)dp->delayed);
+
+	fprintf(fp, "%8s %8s %10s %10s %6s %8s %6s\n", "chunk", "pages",
+	    "chunks", "free", "used", "listed", "spare");
+	for (i = 0; i < dp->nchunks; i++) {
+		dc = &pl->dc[i];
+		if (dc->pages == 0 && dc->spare == 0)
+			continue;
+		fprintf(fp, "%8u %8u %10u %10u %5.1f%% %8u %6u\n", dc->size,
+		    dc->pages, dc->total, dc->free,
+		    percent(dc->total - dc->free, dc->total), dc->listed,
+		    dc->spare);
+	}
+}
+
+/*
+ * Print every pool, then all of them added up.
+ */
+void
+state_report(FILE *fp)
+{
+	struct pool sum;
+	const struct pool *pl;
+	size_t i, n = 0;
+	uint32_t j;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < npools; i++) {
+		pl = &pools[i];
+		if (!pl->seen)
+			continue;
+		fprintf(fp, "Pool %zu: ", i);
+		state_print(fp, pl);
+		fputc('\n', fp);
+
+		n++;
+		sum.dp.regions += pl->dp.regions;
+		sum.dp.regionsfree += pl->dp.regionsfree;
+		sum.dp.used += pl->dp.used;
+		sum.dp.guarded += pl->dp.guarded;
+		sum.dp.big += pl->dp.big;
+		sum.dp.bigpages += pl->dp.bigpages;
+		sum.dp.smallcached += pl->dp.smallcached;
+		sum.dp.smallslots += pl->dp.smallslots;
+		sum.dp.smallpages += pl->dp.smallpages;
+		sum.dp.bigcached += pl->dp.bigcached;
+		sum.dp.bigslots += pl->dp.bigslots;
+		sum.dp.bigcachepages += pl->dp.bigcachepages;
+		sum.dp.delayed += pl->dp.delayed;
+		sum.dp.nchunks = MAX(sum.dp.nchunks, pl->dp.nchunks);
+		for (j = 0; j < pl->dp.nchunks; j++) {
+			sum.dc[j].size = pl->dc[j].size;
+			sum.dc[j].pages += pl->dc[j].pages;
+			sum.dc[j].total += pl->dc[j].total;
+			sum.dc[j].free += pl->dc[j].free;
+			sum.dc[j].listed += pl->dc[j].listed;
+			sum.dc[j].spare += pl->dc[j].spare;
+		}
+	}
+	if (n == 0) {
+		fprintf(fp, "No malloc state in the trace, see the D malloc "
+		    "option\n");
+		return;
+	}
+	fprintf(fp, "All %zu pools: ", n);
+	state_print(fp, &sum);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Statistics about mdump itself (-S).  The counters are plain increments
+ * and always kept.  Only with -S are the clocks read, whenever mdump
+ * moves from one phase to another, so time spent waiting for the trace,
+ * replaying it, symbolizing and reporting can be told apart.  Phases
+ * don't nest: the time of a phase entered from another one is not
+ * counted twice.  The CPU time of a phase is that of the main thread;
+ * the input thread only shows up in the total.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mdump.h"
+
+#define PROGRESS_INTERVAL	10	/* seconds between lines with -SS */
+#define PROGRESS_RECORDS	1024	/* records between looking at the time */
+
+struct mdump_stats stats;
+
+static const char *phasenames[PHASE_MAX] = {
+	"startup", "read", "replay", "symbolize", "checkpoint", "report"
+};
+
+static int level;
+static int phase = PHASE_STARTUP;
+static double phasewall[PHASE_MAX], phasecpu[PHASE_MAX];
+static struct timespec lastwall, lastcpu, startwall;
+static size_t progressrecords;
+static size_t lastevents;
+static double lastprogress;
+
+static double
+tv2d(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double
+tsdiff(const struct timespec *t1, const struct timespec *t0)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static size_t
+stats_nevents(void)
+{
+	return stats.events[MALLOC_TRACE_MALLOC] +
+	    stats.events[MALLOC_TRACE_REALLOC] +
+	    stats.events[MALLOC_TRACE_FREE];
+}
+
+/*
+ * Turn on timing and the report, and with a level of 2 progress lines.
+ */
+void
+stats_init(int lvl)
+{
+	level = lvl;
+	if (level == 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &startwall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &lastcpu);
+	lastwall = startwall;
+}
+
+/*
+ * Charge the time since the last switch to the current phase.
+ */
+static void
+stats_charge(void)
+{
+	struct timespec wall, cpu;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	phasewall[phase] += tsdiff(&wall, &lastwall);
+	phasecpu[phase] += tsdiff(&cpu, &lastcpu);
+	lastwall = wall;
+	lastcpu = cpu;
+}
+
+/*
+ * Enter phase p.  Returns the phase left, to go back to it afterwards.
+ */
+int
+stats_phase(int p)
+{
+	int prev = phase;
+
+	if (level != 0 && p != prev)
+		stats_charge();
+	phase = p;
+	return prev;
+}
+
+static long
+stats_maxrss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		return 0;
+	return ru.ru_maxrss;
+}
+
+/*
+ * Called for every record; with -SS, tell how far the replay got every
+ * PROGRESS_INTERVAL seconds.
+ */
+void
+stats_progress(void)
+{
+	struct timespec wall;
+	double t;
+	size_t n;
+
+	if (level < 2 || ++progressrecords < PROGRESS_RECORDS)
+		return;
+	progressrecords = 0;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	t = tsdiff(&wall, &startwall);
+	if (t - lastprogress < PROGRESS_INTERVAL)
+		return;
+	n = stats_nevents();
+	fprintf(stderr, "%.0fs: %zu records, %zu events (%.0f/s), "
+	    "%zu live, %zu stacks, %zu objects, %ld KB peak rss\n", t,
+	    stats.records, n, (n - lastevents) / (t - lastprogress),
+	    live_count(), nstacks, stats.objects, stats_maxrss());
+	lastprogress = t;
+	lastevents = n;
+}
+
+static double
+percent(size_t n, size_t total)
+{
+	return total == 0 ? 0 : 100.0 * n / total;
+}
+
+/*
+ * Print what was collected to fp.
+ */
+void
+stats_print(FILE *fp)
+{
+	static const char *typenames[] = {
+		[MALLOC_TRACE_MALLOC] = "malloc",
+		[MALLOC_TRACE_REALLOC] = "realloc",
+		[MALLOC_TRACE_FREE] = "free",
+		[MALLOC_TRACE_STACK] = "stack"
+	};
+	struct rusage ru;
+	double wall = 0, cpu = 0, rwall;
+	size_t inmem, spilled, spills;
+	int i;
+
+	if (level == 0)
+		return;
+	stats_charge();
+
+	fprintf(fp, "%-12s %10s %10s\n", "phase", "wall s", "cpu s");
+	for (i = 0; i < PHASE_MAX; i++) {
+		fprintf(fp, "%-12s %10.3f %10.3f\n", phasenames[i],
+		    phasewall[i], phasecpu[i]);
+		wall += phasewall[i];
+		cpu += phasecpu[i];
+	}
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		err(1, "getrusage");
+	fprintf(fp, "%-12s %10.3f %10.3f (%.3f with all threads)\n",
+	    "total", wall, cpu, tv2d(&ru.ru_utime) + tv2d(&ru.ru_stime));
+
+	/* Rates are over the time the trace was being worked on. */
+	rwall = phasewall[PHASE_READ] + phasewall[PHASE_REPLAY] +
+	    phasewall[PHASE_SYMBOLIZE];
+	if (rwall == 0)
+		rwall = 1;
+	fprintf(fp, "%-12s %10zu %10.0f/s, %zu bytes\n", "records",
+	    stats.records, stats.records / rwall, stats.bytes);
+	for (i = MALLOC_TRACE_MALLOC; i <= MALLOC_TRACE_STACK; i++)
+		fprintf(fp, "%-12s %10zu %10.0f/s\n", typenames[i],
+		    stats.events[i], stats.events[i] / rwall);
+
+	live_stats(&inmem, &spilled, &spills);
+	fprintf(fp, "%-12s %10zu allocations, %zu in memory, %zu spilled "
+	    "in %zu spills\n", "live", live_count(), inmem, spilled, spills);
+	fprintf(fp, "%-12s %10zu peak records waiting to be reordered\n",
+	    "reorder", stats.maxevents);
+	fprintf(fp, "%-12s %10zu interned, %zu announced, %.1f%% of lookups "
+	    "found\n",
+	    "stacks", nstacks, ntracestacks,
+	    percent(stats.stackhits, stats.stacklookups));
+	fprintf(fp, "%-12s %10zu segments\n", "load map", nloadsegs);
+	fprintf(fp, "%-12s %10zu frames looked up, %.2f%% symbolized "
+	    "before, %zu not mapped\n", "frames", stats.frames,
+	    percent(stats.framehits, stats.frames), stats.unmapped);
+	fprintf(fp, "%-12s %10zu distinct frames, %zu strings\n", "symbols",
+	    nframes, nsyms);
+	fprintf(fp, "%-12s %10zu symbolized, %zu opens, %llu KB of debug "
+	    "information, %zu with libdwarf\n", "objects", stats.objects,
+	    a2lstats.opened, (unsigned long long)a2lstats.dwarfbytes / 1024,
+	    a2lstats.fallbacks);
+	fprintf(fp, "%-12s %10ld KB\n", "peak rss", ru.ru_maxrss);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Symbolized frames.  A frame is a function, source file and line, and
+ * for inlined code the frame it was inlined into.  Function and file
+ * names are interned once in a string table, and frames in a frame
+ * table; both hand out ids in order of appearance, so objects and the
+ * checkpoint only carry small numbers.  A string can have an alias,
+ * which addr2line() uses to demangle every function name only once.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+struct symstr {
+	size_t id;
+	size_t alias;		/* or SYM_NONE */
+	size_t len;
+	const char *s;		/* follows the struct */
+	RB_ENTRY(symstr) entry;
+};
+
+struct framenode {
+	struct frame f;
+	size_t id;
+	RB_ENTRY(framenode) entry;
+};
+
+RB_HEAD(symstrs, symstr);
+RB_PROTOTYPE_STATIC(symstrs, symstr, entry, symstrcmp)
+RB_HEAD(framenodes, framenode);
+RB_PROTOTYPE_STATIC(framenodes, framenode, entry, framecmp)
+
+static struct symstrs symstrs = RB_INITIALIZER(&symstrs);
+static struct framenodes framenodes = RB_INITIALIZER(&framenodes);
+static struct symstr **symtab;
+static struct framenode **frametab;
+static size_t symtabsize, frametabsize;
+size_t nsyms, nframes;
+
+static int
+symstrcmp(const struct symstr *s1, const struct symstr *s2)
+{
+	return strcmp(s1->s, s2->s);
+}
+
+static int
+framecmp(const struct framenode *n1, const struct framenode *n2)
+{
+	const struct frame *f1 = &n1->f, *f2 = &n2->f;
+
+	if (f1->func != f2->func)
+		return f1->func < f2->func ? -1 : 1;
+	if (f1->file != f2->file)
+		return f1->file < f2->file ? -1 : 1;
+	if (f1->line != f2->line)
+		return f1->line < f2->line ? -1 : 1;
+	if (f1->caller != f2->caller)
+		return f1->caller < f2->caller ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Return the id of string s, adding it if it's new.
+ */
+size_t
+sym_intern(const char *s)
+{
+	struct symstr *sym, search;
+	size_t len;
+
+	search.s = s;
+	if ((sym = RB_FIND(symstrs, &symstrs, &search)) != NULL)
+		return sym->id;
+
+	len = strlen(s);
+	sym = xmalloc(sizeof(*sym) + len + 1);
+	memcpy(sym + 1, s, len + 1);
+	sym->s = (const char *)(sym + 1);
+	sym->len = len;
+	sym->alias = SYM_NONE;
+	RB_INSERT(symstrs, &symstrs, sym);
+
+	if (nsyms == symtabsize) {
+		symtabsize = symtabsize == 0 ? 1024 : symtabsize * 2;
+		if ((symtab = reallocarray(symtab, symtabsize,
+		    sizeof(*symtab))) == NULL)
+			err(1, NULL);
+	}
+	sym->id = nsyms;
+	symtab[nsyms++] = sym;
+	return sym->id;
+}
+
+const char *
+sym_str(size_t id, size_t *lenp)
+{
+	if (id >= nsyms)
+		errx(1, "invalid string id %zu", id);
+	if (lenp != NULL)
+		*lenp = symtab[id]->len;
+	return symtab[id]->s;
+}
+
+size_t
+sym_alias(size_t id)
+{
+	if (id >= nsyms)
+		errx(1, "invalid string id %zu", id);
+	return symtab[id]->alias;
+}
+
+void
+sym_setalias(size_t id, size_t alias)
+{
+	if (id >= nsyms || alias >= nsyms)
+		errx(1, "invalid string id %zu", id);
+	symtab[id]->alias = alias;
+}
+
+/*
+ * Return the id of frame f, adding it if it's new.  Its caller has to be
+ * interned first.
+ */
+size_t
+frame_intern(const struct frame *f)
+{
+	struct framenode *n, search;
+
+	if (f->func >= nsyms || f->file >= nsyms ||
+	    (f->caller != FRAME_NONE && f->caller >= nframes))
+		errx(1, "invalid frame");
+	search.f = *f;
+	if ((n = RB_FIND(framenodes, &framenodes, &search)) != NULL)
+		return n->id;
+
+	n = xmalloc(sizeof(*n));
+	n->f = *f;
+	RB_INSERT(framenodes, &framenodes, n);
+
+	if (nframes == frametabsize) {
+		frametabsize = frametabsize == 0 ? 1024 : frametabsize * 2;
+		if ((frametab = reallocarray(frametab, frametabsize,
+		    sizeof(*frametab))) == NULL)
+			err(1, NULL);
+	}
+	n->id = nframes;
+	frametab[nframes++] = n;
+	return n->id;
+}
+
+const struct frame *
+frame_get(size_t id)
+{
+	if (id >= nframes)
+		errx(1, "invalid frame id %zu", id);
+	return &frametab[id]->f;
+}
+
+/*
+ * Format the innermost function of a frame as one line.
+ */
+void
+frame_snprint(char *buf, size_t size, size_t id)
+{
+	const struct frame *f = frame_get(id);
+
+	snprintf(buf, size, "%s at %s:%lu\n", sym_str(f->func, NULL),
+	    sym_str(f->file, NULL), f->line);
+}
+
+/*
+ * Print a frame and the ones it was inlined into, a line each, the way
+ * addr2line -fip does.
+ */
+void
+frame_print(FILE *fp, size_t id)
+{
+	const struct frame *f;
+	int inlined = 0;
+
+	for (; id != FRAME_NONE; id = f->caller) {
+		f = frame_get(id);
+		if (inlined)
+			fputs(" (inlined by) ", fp);
+		fputs(sym_str(f->func, NULL), fp);
+		fputs(" at ", fp);
+		fputs(sym_str(f->file, NULL), fp);
+		fprintf(fp, ":%lu\n", f->line);
+		inlined = 1;
+	}
+}
+
+RB_GENERATE_STATIC(symstrs, symstr, entry, symstrcmp)
+RB_GENERATE_STATIC(framenodes, framenode, entry, framecmp)
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026 mdump contributors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Watched pointers and address ranges (-P).  The ranges are merged into
+ * a sorted array of disjoint intervals, so checking whether a block
+ * overlaps any of them is a binary search.
+ */
+
+#include <sys/param.h>
+#include <sys/ktrace.h>
+#include <sys/tree.h>
+
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mdump.h"
+
+struct watch {
+	uintptr_t lo;
+	uintptr_t hi;		/* inclusive */
+};
+
+static struct watch *watches;
+static size_t nwatches;
+
+static uintptr_t
+watch_parseaddr(const char *arg, const char *s, char **endptr)
+{
+	unsigned long long v;
+
+	v = strtoull(s, endptr, 16);
+	if (*endptr == s || v > UINTPTR_MAX)
+		errx(1, "-P %s: invalid", arg);
+	return v;
+}
+
+/*
+ * Add a pointer (addr) or an inclusive range (lo-hi), in hex.
+ */
+void
+watch_add(const char *arg)
+{
+	struct watch w;
+	char *endptr;
+
+	w.lo = w.hi = watch_parseaddr(arg, arg, &endptr);
+	if (*endptr == '-')
+		w.hi = watch_parseaddr(arg, endptr + 1, &endptr);
+	if (*endptr != '\0' || w.lo > w.hi || w.hi == 0)
+		errx(1, "-P %s: invalid", arg);
+
+	if ((watches = reallocarray(watches, nwatches + 1,
+	    sizeof(*watches))) == NULL)
+		err(1, NULL);
+	watches[nwatches++] = w;
+}
+
+static int
+watchcmp(const void *v1, const void *v2)
+{
+	const struct watch *w1 = v1, *w2 = v2;
+
+	return w1->lo < w2->lo ? -1 : w1->lo > w2->lo;
+}
+
+/*
+ * Sort and merge the ranges; call once after the last watch_add().
+ */
+void
+watch_done(void)
+{
+	size_t i, n;
+
+	if (nwatches == 0)
+		return;
+	qsort(watches, nwatches, sizeof(*watches), watchcmp);
+	for (i = 1, n = 0; i < nwatches; i++) {
+		if (watches[n].hi == UINTPTR_MAX ||
+		    watches[i].lo <= watches[n].hi + 1) {
+			watches[n].hi = MAX(watches[n].hi, watches[i].hi);
+			continue;
+		}
+		watches[++n] = watches[i];
+	}
+	nwatches = n + 1;
+}
+
+int
+watch_active(void)
+{
+	return nwatches != 0;
+}
+
+/*
+ * Does the block of size bytes at p overlap a watched range?
+ */
+int
+watch_hit(uintptr_t p, size_t size)
+{
+	size_t lo = 0, hi = nwatches, mid;
+	uintptr_t end;
+
+	if (nwatches == 0)
+		return 0;
+	if (size == 0)
+		size = 1;
+	end = size - 1 > UINTPTR_MAX - p ? UINTPTR_MAX : p + (size - 1);
+
+	/* First range ending at or after p. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (watches[mid].hi < p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < nwatches && watches[lo].lo <= end;
+}